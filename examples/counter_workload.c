@@ -0,0 +1,26 @@
+/* Workload equivalent to the built-in one with --ops-per-action=1.
+ *
+ * Usage: make examples && ./action_chain_test --workload=./libcounter_workload.so */
+
+#include "action_chain_workload.h"
+
+static volatile uint64_t counter;
+
+void* action_chain_workload_init(uint64_t num_threads) {
+  (void)num_threads;
+  counter = 0;
+  return (void*)&counter;
+}
+
+void action_chain_workload_run(void* ctx, uint64_t thread_index) {
+  (void)ctx;
+  (void)thread_index;
+  ++counter;
+}
+
+int action_chain_workload_verify(void* ctx, uint64_t num_actions) {
+  (void)ctx;
+  return counter == num_actions ? 0 : -1;
+}
+
+void action_chain_workload_teardown(void* ctx) { (void)ctx; }
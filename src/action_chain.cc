@@ -1,22 +1,180 @@
 #include "action_chain.h"
 
+#include <time.h>
+
+#ifdef ROMKATV_ACTION_CHAIN_CENSUS
+#include <algorithm>
+#endif
+
 namespace romkatv {
 
-thread_local ActionChain::Mem ActionChain::mem_;
+std::chrono::steady_clock::time_point CoarseNow() {
+#ifdef CLOCK_MONOTONIC_COARSE
+  // CLOCK_MONOTONIC_COARSE has the same epoch as CLOCK_MONOTONIC, which backs
+  // steady_clock on Linux, but is read without a syscall.
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return std::chrono::steady_clock::time_point(std::chrono::seconds(ts.tv_sec) +
+                                               std::chrono::nanoseconds(ts.tv_nsec));
+#else
+  return std::chrono::steady_clock::now();
+#endif
+}
+
+void* ActionChain::NewTlsMem() {
+  // Constructed on the first call on every thread. Keeping it out of Run() means that
+  // threads that never call it or call it rarely don't pay for the TLS guard.
+  static thread_local struct Reaper {
+    ~Reaper() { ::operator delete(std::exchange(tls_mem_, nullptr), kAllocSize); }
+  } reaper;
+  static_cast<void>(reaper);
+  return ::operator new(kAllocSize);
+}
+
+#ifdef ROMKATV_ACTION_CHAIN_CENSUS
+ActionChain::CensusEntry::CensusEntry(std::string_view pretty_function, std::size_t size,
+                                      std::size_t align, std::size_t node_size)
+    : stats_{pretty_function, size, align, node_size, 0} {
+  // Extract F from "... [with F = Foo; ...]" (GCC) or "... [F = Foo]" (Clang).
+  std::string_view& name = stats_.name;
+  if (std::size_t pos = name.find("F = "); pos != std::string_view::npos) {
+    name.remove_prefix(pos + 4);
+    name = name.substr(0, std::min(name.find(';'), name.rfind(']')));
+  }
+  next_ = census_.load(std::memory_order_relaxed);
+  while (!census_.compare_exchange_weak(next_, this, std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+  }
+}
+
+std::vector<ActionChain::TypeStats> ActionChain::Census() {
+  std::vector<TypeStats> res;
+  for (CensusEntry* e = census_.load(std::memory_order_acquire); e; e = e->next_) {
+    res.push_back(e->stats_);
+    res.back().runs = e->runs_.load(std::memory_order_relaxed);
+  }
+  std::stable_sort(res.begin(), res.end(),
+                   [](const TypeStats& x, const TypeStats& y) { return x.runs > y.runs; });
+  return res;
+}
+#endif
+
+ActionChain::Condition::~Condition() {
+  while (Waiter* w = head_) {
+    head_ = w->next_;
+    w->Poll(false);
+  }
+}
+
+ActionChain::~ActionChain() {
+  Work::Delete(tail_.load(std::memory_order_acquire));
+  assert(!next_actions_);
+  ::operator delete(spare_, kAllocSize);
+}
+
+void ActionChain::Park(Waiter* w) {
+  Condition* c = w->cond_;
+  if (!c->head_ && w->Poll(true)) return;
+  *c->tail_ = w;
+  c->tail_ = &w->next_;
+  if (c == &always_) poll_ = true;
+}
+
+// Runs parked actions from the front of the queue while their predicates are true.
+// Returns true if it has run at least one action.
+bool ActionChain::Poll(Condition* c) {
+  bool progress = false;
+  while (Waiter* w = c->head_) {
+    Waiter* next = w->next_;
+    if (!w->Poll(true)) break;
+    if (!(c->head_ = next)) c->tail_ = &c->head_;
+    // Continuations of the action must run before the next parked action.
+    RunContinuations();
+    progress = true;
+  }
+  return progress;
+}
+
+void ActionChain::DrainTrampolined(Trampoline* t, Work* w) {
+  if (t->draining_) {
+    deferred_ = w;
+    *t->tail_ = this;
+    t->tail_ = &next_deferred_;
+    return;
+  }
+  t->draining_ = true;
+  Work::RunAll(this, w);
+  while (ActionChain* c = t->head_) {
+    if (!(t->head_ = std::exchange(c->next_deferred_, nullptr))) t->tail_ = &t->head_;
+    Work::RunAll(c, std::exchange(c->deferred_, nullptr));
+  }
+  t->draining_ = false;
+}
+
+void ActionChain::AfterAction() {
+  RunContinuations();
+  // Continuations of parked actions run from Poll(), so there are none left after this.
+  if (poll_) PollWaiters();
+  assert(!next_actions_);
+}
 
-void ActionChain::Work::RunAllSlow(Work* w, Work* next) {
+void ActionChain::RunContinuations() {
+  while (Work* w = next_actions_) {
+    next_actions_ = w->local_next_;
+    next_pos_ = nullptr;
+    w->invoke_(w);
+    std::size_t size = w->size_;
+    w->~Work();
+    if (spare_ || size != kAllocSize) {
+      ::operator delete(w, size);
+    } else {
+      spare_ = w;
+    }
+  }
+  next_pos_ = nullptr;
+}
+
+void ActionChain::PollWaiters() {
+  bool progress;
+  do {
+    progress = Poll(&always_);
+    while (Condition* c = notified_) {
+      notified_ = c->next_notified_;
+      c->notified_ = false;
+      progress |= Poll(c);
+    }
+    // Actions that we've just run might have changed the predicates.
+  } while (progress && always_.head_);
+  poll_ = always_.head_ != nullptr;
+}
+
+void ActionChain::Work::RunAllSlow(ActionChain* chain, Work* w, Work* next) {
+  // Knowing where the list ends doesn't help: the drainer still has to load `next_` of
+  // every node to find the next one, and an acquire load costs the same as a relaxed one
+  // on x86. Reading `tail_` to find the end would only add a transfer of the cache line
+  // that all producers write.
   do {
     do {
       assert(w != nullptr && w != Sealed());
       assert(next != nullptr && next != Sealed());
-      w->Destroy();
-      ::operator delete(w, kAllocSize);
+      Work::Delete(w);
       w = next;
-      w->invoke_(w);
+      w->Execute(chain);
       next = w->next_.load(std::memory_order_acquire);
+      if (!next && chain->linger_spins_) next = Linger(chain, w);
     } while (next);
     next = w->next_.exchange(Sealed(), std::memory_order_acq_rel);
   } while (next);
 }
 
+ActionChain::Work* ActionChain::Work::Linger(ActionChain* chain, Work* w) {
+  for (std::uint32_t i = 0; i != chain->linger_spins_; ++i) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+    if (Work* next = w->next_.load(std::memory_order_acquire)) return next;
+  }
+  return nullptr;
+}
+
 }  // namespace romkatv
@@ -1,23 +1,37 @@
 #ifndef ROMKATV_ACTION_CHAIN_ACTION_CHAIN_H_
-#define ROMKATV_ACTION_CHAIN_ACTION_CHAIN_H
+#define ROMKATV_ACTION_CHAIN_ACTION_CHAIN_H_
 
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
+#include <cstdint>
 #include <mutex>
 #include <new>
 #include <thread>
+#include <tuple>
 #include <type_traits>
 #include <utility>
 
+#ifdef ROMKATV_ACTION_CHAIN_CENSUS
+#include <string_view>
+#include <vector>
+#endif
+
 namespace romkatv {
 
+// Like std::chrono::steady_clock::now() but several times faster and less precise: the
+// result may lag by a few milliseconds.
+std::chrono::steady_clock::time_point CoarseNow();
+
 // Wait-free queue of actions. Can be used as an alternative to locking.
 //
 // TODO: Figure out whether memory order constraints can be relaxed.
 class ActionChain {
+  class Waiter;
+
  public:
   class Mem {
    public:
@@ -36,13 +50,80 @@ class ActionChain {
     void* p_;
   };
 
-  ActionChain() { Work::RunAll(tail_.load(std::memory_order_relaxed)); }
-  ActionChain(ActionChain&&) = delete;
-  ~ActionChain() {
-    Work* p = tail_.load(std::memory_order_acquire);
-    p->Destroy();
-    ::operator delete(p, kAllocSize);
+  // A FIFO queue of actions parked by RunWhen(). See Notify().
+  class Condition {
+   public:
+    Condition() {}
+    Condition(Condition&&) = delete;
+    // Destroys parked actions without running them.
+    ~Condition();
+
+   private:
+    friend class ActionChain;
+
+    Waiter* head_ = nullptr;
+    Waiter** tail_ = &head_;
+    // Link in ActionChain::notified_.
+    Condition* next_notified_ = nullptr;
+    bool notified_ = false;
+  };
+
+  // While a Trampoline is alive, drains that Run() would start from within actions on
+  // the same thread are deferred until the outermost drain on this thread completes.
+  // This bounds stack depth when actions on one chain schedule actions on another
+  // idle chain, which schedule actions on yet another chain, and so on.
+  //
+  // Deferred actions still run in the right order relative to other actions on their
+  // chains, just later. A chain that is never idle postpones them indefinitely.
+  //
+  // Trampolines are per thread and can be nested. Only the outermost has effect.
+  //
+  // Example:
+  //
+  //   void WorkerThread() {
+  //     ActionChain::Trampoline trampoline;
+  //     while (Request* req = NextRequest()) parse_chain.Run([=] { Parse(req); });
+  //   }
+  class Trampoline {
+   public:
+    Trampoline() : active_(!trampoline_) {
+      if (active_) trampoline_ = this;
+    }
+    Trampoline(Trampoline&&) = delete;
+    ~Trampoline() {
+      assert(!draining_ && !head_);
+      if (active_) trampoline_ = nullptr;
+    }
+
+   private:
+    friend class ActionChain;
+
+    const bool active_;
+    // True while a drain is in progress on this thread.
+    bool draining_ = false;
+    // Chains with deferred drains linked via ActionChain::next_deferred_.
+    ActionChain* head_ = nullptr;
+    ActionChain** tail_ = &head_;
+  };
+
+  struct Options {
+    // When the drainer runs out of actions, it checks for new ones this many times
+    // before giving up the drain. Under bursty load this keeps the drain, and the
+    // state guarded by the chain, on one thread instead of handing them to the next
+    // producer. Zero means no lingering. The cost is up to this many wasted spins per
+    // drain on the draining thread.
+    std::uint32_t linger_spins = 0;
+  };
+
+  ActionChain() : ActionChain(Options()) {}
+  explicit ActionChain(Options opt) : linger_spins_(opt.linger_spins) {
+    // No other thread can see the chain yet, so there is nothing to drain or linger for.
+    Work* w = tail_.load(std::memory_order_relaxed);
+    w->Execute(this);
+    w->next_.store(Work::Sealed(), std::memory_order_relaxed);
   }
+  ActionChain(ActionChain&&) = delete;
+  ~ActionChain();
 
   // Either executes `action` synchronously (in which case some other actions added
   // concurrently by other threads may also run synchronously after `f` returns)
@@ -55,6 +136,11 @@ class ActionChain {
   // things up. Note that Mem is not thread safe. You must not pass the same instance
   // of Mem concurrently to multiple Run() calls.
   //
+  // Several actions can be passed at once. This has the same effect as passing them
+  // one by one in separate Run() calls except that nothing can run between them, and
+  // it's cheaper: all actions share a single node. Captured state is destroyed after
+  // the last action returns.
+  //
   // Example:
   //
   //   // These counters are updated atomically after every request.
@@ -74,37 +160,382 @@ class ActionChain {
   //       });
   //     }
   //   }
-  template <class F>
-  void Run(Mem* mem, F&& action) {
+  template <class F, class... Fs>
+  void Run(Mem* mem, F&& action, Fs&&... actions) {
     assert(mem);
-    if (!mem->p_) mem->p_ = ::operator new(kAllocSize);
-    Work* work = Work::New(mem->p_, std::forward<F>(action));
-    mem->p_ = tail_.exchange(work, std::memory_order_acq_rel)->ContinueWith(work);
+    if constexpr (sizeof...(Fs) != 0) {
+      Run(mem, Fused<std::decay_t<F>, std::decay_t<Fs>...>{
+                   {std::forward<F>(action), std::forward<Fs>(actions)...}});
+    } else {
+      Emplace<std::decay_t<F>>(mem, std::forward<F>(action));
+    }
   }
 
   template <class F>
   void Run(F&& action) {
-    Run(&mem_, std::forward<F>(action));
+    Emplace<std::decay_t<F>>(std::forward<F>(action));
+  }
+
+  // Like Run() but the action is `fn(ctx)`. Every lambda passed to Run() gets its own
+  // copy of the code that runs and destroys it. All actions added with RunCall() share
+  // one. In programs with many distinct actions of this shape this keeps the drainer's
+  // code small, which helps the instruction cache.
+  //
+  // Example:
+  //
+  //   void Flush(void* conn) { static_cast<Connection*>(conn)->Flush(); }
+  //
+  //   mutex.RunCall(&mem, &Flush, conn);
+  //
+  // There is no form with more context: it wouldn't fit into memory that Mem recycles.
+  // Pass a pointer to a struct instead.
+  void RunCall(Mem* mem, void (*fn)(void*), void* ctx) { Run(mem, Call{fn, ctx}); }
+  void RunCall(void (*fn)(void*), void* ctx) { Run(Call{fn, ctx}); }
+
+  // Like Run() but constructs the action of type F from `args` directly in the memory
+  // where it's stored until it runs. This saves a move of the action and works with
+  // types that can't be moved.
+  //
+  // Example:
+  //
+  //   struct Log {
+  //     void operator()() { Write(level, msg); }
+  //     int level;
+  //     std::string msg;
+  //   };
+  //
+  //   void Warn(const std::string& msg) { mutex.Emplace<Log>(&mem, 2, msg); }
+  template <class F, class... Args>
+  void Emplace(Mem* mem, Args&&... args) {
+    assert(mem);
+    if (Work::NodeSize<F>() == kAllocSize && !mem->p_) mem->p_ = ::operator new(kAllocSize);
+    Push<F>(&mem->p_, std::forward<Args>(args)...);
+  }
+
+  template <class F, class... Args>
+  void Emplace(Args&&... args) {
+    // Even if the action doesn't need it: NewTlsMem() arranges for tls_mem_ to be freed,
+    // and ContinueWith() may store memory there.
+    if (!tls_mem_) tls_mem_ = NewTlsMem();
+    Push<F>(&tls_mem_, std::forward<Args>(args)...);
+  }
+
+  // Like Run() but if `action` hasn't started by `deadline`, runs `on_expired` instead.
+  // Under overload this sheds actions whose results are no longer useful, so that the
+  // chain catches up sooner.
+  //
+  // The deadline is checked against a coarse clock when the action reaches the front
+  // of the chain. An action can start up to a few milliseconds after its deadline.
+  //
+  // Example:
+  //
+  //   // Thread-safe. Replies with an error if the cache is too busy to answer within
+  //   // 10ms.
+  //   void Lookup(Request* req) {
+  //     auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+  //     mutex.RunWithDeadline(
+  //         deadline, [=] { req->Reply(cache.Find(req->key())); },
+  //         [=] { req->Reply(Status::kOverloaded); });
+  //   }
+  template <class F, class E>
+  void RunWithDeadline(Mem* mem, std::chrono::steady_clock::time_point deadline, F&& action,
+                       E&& on_expired) {
+    Run(mem, Expiring<std::decay_t<F>, std::decay_t<E>>{deadline, std::forward<F>(action),
+                                                        std::forward<E>(on_expired)});
+  }
+
+  template <class F, class E>
+  void RunWithDeadline(std::chrono::steady_clock::time_point deadline, F&& action,
+                       E&& on_expired) {
+    Run(Expiring<std::decay_t<F>, std::decay_t<E>>{deadline, std::forward<F>(action),
+                                                   std::forward<E>(on_expired)});
+  }
+
+  // Same as above but drops expired actions.
+  template <class F>
+  void RunWithDeadline(Mem* mem, std::chrono::steady_clock::time_point deadline, F&& action) {
+    Run(mem, Expiring<std::decay_t<F>, void>{deadline, std::forward<F>(action)});
+  }
+
+  template <class F>
+  void RunWithDeadline(std::chrono::steady_clock::time_point deadline, F&& action) {
+    Run(Expiring<std::decay_t<F>, void>{deadline, std::forward<F>(action)});
+  }
+
+  // Runs `action` once `pred()` returns true. Both are invoked on the chain.
+  //
+  // RunWhen() is scheduled like Run(): `pred` is first evaluated after all previously
+  // scheduled actions have completed. If it returns true, `action` runs right away.
+  // Otherwise `action` is parked and `pred` is re-evaluated after every subsequent
+  // action until it returns true. Parked actions don't hold up the chain: actions
+  // scheduled after them keep running.
+  //
+  // Actions parked by this overload run in the order they were parked. `pred` isn't
+  // evaluated until all actions parked before it have run.
+  //
+  // Example:
+  //
+  //   std::deque<Request> requests;  // guarded by `mutex`
+  //   ActionChain mutex;
+  //
+  //   // Thread-safe. Doesn't block.
+  //   void ServeOne() {
+  //     mutex.RunWhen([] { return !requests.empty(); },
+  //                   [] {
+  //                     Serve(std::move(requests.front()));
+  //                     requests.pop_front();
+  //                   });
+  //   }
+  template <class P, class F>
+  void RunWhen(Mem* mem, P&& pred, F&& action) {
+    RunWhen(mem, &always_, std::forward<P>(pred), std::forward<F>(action));
+  }
+
+  // Same as above except that the action is parked on `cond`, and `pred` is
+  // re-evaluated only after Notify(cond). Actions parked on the same condition run in
+  // the order they were parked. `cond` must be used with only one chain.
+  template <class P, class F>
+  void RunWhen(Mem* mem, Condition* cond, P&& pred, F&& action) {
+    assert(cond);
+    Waiter* w = Waiter::New(cond, std::forward<P>(pred), std::forward<F>(action));
+    Run(mem, [this, w] { Park(w); });
+  }
+
+  template <class P, class F>
+  void RunWhen(P&& pred, F&& action) {
+    RunWhen(&always_, std::forward<P>(pred), std::forward<F>(action));
+  }
+
+  template <class P, class F>
+  void RunWhen(Condition* cond, P&& pred, F&& action) {
+    assert(cond);
+    Waiter* w = Waiter::New(cond, std::forward<P>(pred), std::forward<F>(action));
+    Run([this, w] { Park(w); });
+  }
+
+  // Runs `action` immediately after the current action, ahead of all actions scheduled
+  // with Run(). Must be called from an action running on this chain.
+  //
+  // If called several times from the same action, the continuations run in the order
+  // they were added. RunNext() is cheaper than Run() as it doesn't synchronize with
+  // other threads.
+  //
+  // Example:
+  //
+  //   // Thread-safe. Handshake() runs three steps back-to-back without letting other
+  //   // actions on `mutex` in between.
+  //   void Handshake(Connection* conn) {
+  //     mutex.Run([=] {
+  //       conn->SendHello();
+  //       mutex.RunNext([=] {
+  //         conn->SendKeys();
+  //         mutex.RunNext([=] { conn->SendFinished(); });
+  //       });
+  //     });
+  //   }
+  template <class F>
+  void RunNext(F&& action) {
+    constexpr std::size_t kSize = Work::NodeSize<F>();
+    void* p =
+        kSize == kAllocSize && spare_ ? std::exchange(spare_, nullptr) : ::operator new(kSize);
+    Work* w = Work::New(p, std::forward<F>(action));
+    Work** pos = next_pos_ ? &next_pos_->local_next_ : &next_actions_;
+    w->local_next_ = *pos;
+    *pos = w;
+    next_pos_ = w;
   }
 
+  // Causes predicates of actions parked on `cond` to be re-evaluated after the current
+  // action completes. Must be called from an action running on this chain.
+  void Notify(Condition* cond) {
+    assert(cond);
+    if (!cond->notified_) {
+      cond->notified_ = true;
+      cond->next_notified_ = notified_;
+      notified_ = cond;
+    }
+    poll_ = true;
+  }
+
+#ifdef ROMKATV_ACTION_CHAIN_CENSUS
+  // Statistics of one action type.
+  struct TypeStats {
+    // As spelled by the compiler. Lambdas are named after the enclosing function.
+    std::string_view name;
+    std::size_t size;
+    std::size_t align;
+    // The number of bytes allocated for a node with this action.
+    std::size_t node_size;
+    // The number of times an action of this type has run on any chain.
+    std::uint64_t runs;
+  };
+
+  // Returns statistics of all action types in the program, the most frequently run
+  // first. Available only when ROMKATV_ACTION_CHAIN_CENSUS is defined, which costs
+  // an atomic increment per action.
+  //
+  // Actions added with several actions per Run() call, RunWithDeadline() or RunWhen()
+  // are counted as wrapper types.
+  static std::vector<TypeStats> Census();
+#endif
+
  private:
+  // The size of nodes that are recycled via Mem. Nodes for larger actions are
+  // allocated and freed individually.
   static constexpr std::size_t kAllocSize = 32;
+  static constexpr std::size_t kCacheLineSize = 64;
+
+#ifdef ROMKATV_ACTION_CHAIN_CENSUS
+  // Registers itself in census_ on construction.
+  class CensusEntry {
+   public:
+    CensusEntry(std::string_view pretty_function, std::size_t size, std::size_t align,
+                std::size_t node_size);
+    CensusEntry(CensusEntry&&) = delete;
+
+   private:
+    friend class ActionChain;
+
+    TypeStats stats_;
+    std::atomic<std::uint64_t> runs_{0};
+    CensusEntry* next_;
+  };
+
+  template <class F>
+  static constexpr std::string_view PrettyFunction() {
+    return __PRETTY_FUNCTION__;
+  }
+
+  // All entries linked via CensusEntry::next_.
+  static inline std::atomic<CensusEntry*> census_{nullptr};
+#endif
+
+  // An action passed to RunWithDeadline().
+  template <class F, class E>
+  struct Expiring {
+    void operator()() {
+      if (CoarseNow() < deadline) {
+        std::move(action)();
+      } else {
+        std::move(on_expired)();
+      }
+    }
+
+    std::chrono::steady_clock::time_point deadline;
+    F action;
+    E on_expired;
+  };
+
+  // An action passed to RunWithDeadline() without `on_expired`. Storing no callback
+  // keeps small actions in the same node size as with Run().
+  template <class F>
+  struct Expiring<F, void> {
+    void operator()() {
+      if (CoarseNow() < deadline) std::move(action)();
+    }
+
+    std::chrono::steady_clock::time_point deadline;
+    F action;
+  };
+
+  // Actions added with RunCall().
+  struct Call {
+    void operator()() const { fn(ctx); }
+    void (*fn)(void*);
+    void* ctx;
+  };
+
+  // Several actions passed to one Run() call.
+  template <class... F>
+  struct Fused {
+    void operator()() {
+      std::apply([](F&... f) { (std::move(f)(), ...); }, actions);
+    }
+
+    std::tuple<F...> actions;
+  };
+
+  // An action parked by RunWhen().
+  class Waiter {
+   public:
+    template <class P, class F>
+    static Waiter* New(Condition* cond, P&& pred, F&& action) {
+      using Impl = WaiterImpl<std::decay_t<P>, std::decay_t<F>>;
+      return new Impl(cond, std::forward<P>(pred), std::forward<F>(action));
+    }
+
+    // If `run` is true and the predicate is false, returns false. Otherwise runs
+    // the action if `run` is true, deletes the waiter and returns true.
+    bool Poll(bool run) { return poll_(this, run); }
+
+    Condition* const cond_;
+    Waiter* next_ = nullptr;
+
+   protected:
+    Waiter(Condition* cond, bool (*poll)(Waiter*, bool)) : cond_(cond), poll_(poll) {}
+
+   private:
+    bool (*poll_)(Waiter*, bool);
+  };
+
+  template <class P, class F>
+  class WaiterImpl : public Waiter {
+   public:
+    template <class PP, class FF>
+    WaiterImpl(Condition* cond, PP&& pred, FF&& action)
+        : Waiter(cond, &WaiterImpl::PollImpl),
+          pred_(std::forward<PP>(pred)),
+          action_(std::forward<FF>(action)) {}
+
+   private:
+    static bool PollImpl(Waiter* w, bool run) {
+      WaiterImpl* self = static_cast<WaiterImpl*>(w);
+      if (run) {
+        if (!self->pred_()) return false;
+        std::move(self->action_)();
+      }
+      delete self;
+      return true;
+    }
+
+    P pred_;
+    F action_;
+  };
 
   class Work {
    public:
     template <class F>
     static Work* New(void* p, F&& f) {
+      return Emplace<std::decay_t<F>>(p, std::forward<F>(f));
+    }
+
+    // Constructs F from `args` after the node.
+    template <class F, class... Args>
+    static Work* Emplace(void* p, Args&&... args) {
+      static_assert(std::is_same_v<F, std::decay_t<F>>);
       // This is easy to fix with no adverse effects for the code that currently
       // compiles.
       static_assert(alignof(F) <= alignof(Work), "Sorry, not implemented");
-      // This might be a bit trickier to fix without slowing down existing code.
-      static_assert(sizeof(Work) + sizeof(F) <= kAllocSize);
       Work* w = new (p) Work;
-      w->invoke_ = &Work::Invoke<std::decay_t<F>>;
-      new (w + 1) std::decay_t<F>(std::forward<F>(f));
+      w->invoke_ = &Work::Invoke<F>;
+      new (w + 1) F(std::forward<Args>(args)...);
       return w;
     }
 
+    // The number of bytes to allocate for a node with action F: a multiple of
+    // kAllocSize.
+    template <class F>
+    static constexpr std::size_t NodeSize() {
+      return (sizeof(Work) + sizeof(std::decay_t<F>) + kAllocSize - 1) / kAllocSize * kAllocSize;
+    }
+
+    // Called exactly once, after Execute().
+    static void Delete(Work* w) {
+      std::size_t size = w->size_;
+      w->Destroy();
+      ::operator delete(w, size);
+    }
+
     // Called exactly once.
     void Destroy() {
       assert(next_.load(std::memory_order_relaxed) != nullptr);
@@ -112,54 +543,156 @@ class ActionChain {
     }
 
     // Called exactly once for every instance of Work except the very last one.
-    // Returns null or raw memory of kAllocSize bytes.
-    void* ContinueWith(Work* next) {
+    // If it runs actions, it first frees this node or, if `*mem` is null, stores it
+    // there as raw memory of kAllocSize bytes.
+    void ContinueWith(ActionChain* chain, Work* next, void** mem) {
       assert(next != nullptr && next != Sealed());
       if (Work* w = next_.load(std::memory_order_acquire)
                         ?: next_.exchange(next, std::memory_order_acq_rel)) {
         static_cast<void>(w);
         assert(w == Sealed());
-        Destroy();
-        RunAll(next);
-        return this;
+        if (size_ == kAllocSize && !*mem) {
+          Destroy();
+          *mem = this;
+        } else {
+          Delete(this);
+        }
+        chain->Drain(next);
       }
-      return nullptr;
     }
 
-    static void RunAll(Work* w) {
+    static void RunAll(ActionChain* chain, Work* w) {
       assert(w != nullptr && w != Sealed());
-      w->invoke_(w);
+      w->Execute(chain);
+      if (chain->linger_spins_) {
+        if (Work* next = Linger(chain, w)) return RunAllSlow(chain, w, next);
+      }
       if (Work* next = w->next_.exchange(Sealed(), std::memory_order_acq_rel)) {
         assert(next != Sealed());
-        RunAllSlow(w, next);
+        RunAllSlow(chain, w, next);
       }
     }
 
    private:
+    friend class ActionChain;
+
     Work() {}
 
     static Work* Sealed() { return reinterpret_cast<Work*>(alignof(Work)); }
 
-    static void RunAllSlow(Work* w, Work* next);
+    static void RunAllSlow(ActionChain* chain, Work* w, Work* next);
+    // Spins up to Options::linger_spins times waiting for an action after `w`.
+    // Returns it or null.
+    static Work* Linger(ActionChain* chain, Work* w);
+
+    void Execute(ActionChain* chain) {
+      invoke_(this);
+      if (chain->next_actions_ || chain->poll_) chain->AfterAction();
+    }
 
     // Called exactly once.
     template <class F>
     static void Invoke(Work* w) {
       assert(w != nullptr && w != Sealed());
       F& f = *reinterpret_cast<F*>(w + 1);
+#ifdef ROMKATV_ACTION_CHAIN_CENSUS
+      census_entry_<F>.runs_.fetch_add(1, std::memory_order_relaxed);
+#endif
       std::move(f)();
       f.~F();
+      w->size_ = NodeSize<F>();
     }
 
-    std::atomic<Work*> next_{nullptr};
-    void (*invoke_)(Work*);
+    union {
+      std::atomic<Work*> next_{nullptr};
+      // Used instead of next_ by continuations added with RunNext().
+      Work* local_next_;
+    };
+    union {
+      void (*invoke_)(Work*);
+      // The size of the node. Set once the action has run.
+      std::size_t size_;
+    };
   };
 
-  static thread_local Mem mem_;
+  // Called from an action. Runs `w` if it doesn't need to wait, otherwise parks it.
+  void Park(Waiter* w);
+  // Runs an action of type F constructed from `args`. If the action fits into
+  // kAllocSize bytes, `*mem` must point to raw memory of this size. Otherwise `*mem`
+  // is left alone or, if null, may receive such memory.
+  template <class F, class... Args>
+  void Push(void** mem, Args&&... args) {
+    // Actions that we might run from ContinueWith() may call Run() with the same `mem`.
+    // It must not point to `work` when they do.
+    constexpr std::size_t kSize = Work::NodeSize<F>();
+    void* p = kSize == kAllocSize ? std::exchange(*mem, nullptr) : ::operator new(kSize);
+    Work* work = Work::Emplace<F>(p, std::forward<Args>(args)...);
+    tail_.exchange(work, std::memory_order_acq_rel)->ContinueWith(this, work, mem);
+  }
+
+  // Returns raw memory of kAllocSize bytes for tls_mem_ and arranges for tls_mem_ to
+  // be freed when the thread exits.
+  static void* NewTlsMem();
+
+  // Runs `w` and all actions after it. The calling thread must own the drain.
+  void Drain(Work* w) {
+    if (Trampoline* t = trampoline_) {
+      DrainTrampolined(t, w);
+    } else {
+      Work::RunAll(this, w);
+    }
+  }
+
+  void DrainTrampolined(Trampoline* t, Work* w);
+
+  // Runs continuations added with RunNext() and actions parked by RunWhen() that
+  // are ready to run.
+  void AfterAction();
+  // Runs continuations added with RunNext().
+  void RunContinuations();
+  // Re-evaluates predicates of parked actions that may have become true.
+  void PollWaiters();
+  bool Poll(Condition* c);
+
+  // Memory for Run() without Mem. Unlike a thread_local Mem, this has no constructor
+  // or destructor, so accessing it doesn't need a TLS guard.
+  static inline thread_local void* tls_mem_ = nullptr;
+  static inline thread_local Trampoline* trampoline_ = nullptr;
+
+#ifdef ROMKATV_ACTION_CHAIN_CENSUS
+  // Constructed before main() for every action type that can run.
+  template <class F>
+  static inline CensusEntry census_entry_{PrettyFunction<F>(), sizeof(F), alignof(F),
+                                          Work::NodeSize<F>()};
+#endif
 
   std::atomic<Work*> tail_{Work::New(::operator new(kAllocSize), [] {})};
+
+  // The rest is accessed only from actions. It's kept away from `tail_`, which is
+  // written by producers, so that the drainer's check after every action doesn't miss
+  // the cache whenever a producer adds an action. This makes the chain a few cache
+  // lines large instead of one pointer. Keeping this state in a separate allocation
+  // would save space but add a dependent load after every action.
+
+  // Continuations added with RunNext() in FIFO order.
+  alignas(kCacheLineSize) Work* next_actions_ = nullptr;
+  // The last continuation added by the current action. RunNext() inserts after it.
+  Work* next_pos_ = nullptr;
+  // Memory of the last completed continuation for reuse by RunNext().
+  void* spare_ = nullptr;
+  // True if PollWaiters() must be called after the current action.
+  bool poll_ = false;
+  // Options::linger_spins. Next to poll_, which is read after every action.
+  const std::uint32_t linger_spins_;
+  // Conditions passed to Notify() since the last call to PollWaiters().
+  Condition* notified_ = nullptr;
+  // Implicitly notified after every action.
+  Condition always_;
+  // The first action of a drain deferred by Trampoline.
+  Work* deferred_ = nullptr;
+  ActionChain* next_deferred_ = nullptr;
 };
 
 }  // namespace romkatv
 
-#endif  // ROMKATV_ACTION_CHAIN_ACTION_CHAIN_H
+#endif  // ROMKATV_ACTION_CHAIN_ACTION_CHAIN_H_
@@ -4,11 +4,170 @@
 //
 // Options:
 //
+//   --scenario=SCENARIO   benchmark scenario; defaults to counter
 //   --sync=SYNC           synchronization primitive
 //   --threads=NUM         number of threads running synchronized actions
 //   --ops-per-action=NUM  number of primitive operations per action
 //   --actions=NUM         total number of actions for all threads; zero value means
 //                         default, which depends on other flags
+//   --capacity=NUM        queue capacity in bounded-queue and deque scenarios and the
+//                         number of nodes of SharedActionChain in cross-process
+//                         scenario
+//   --keys=NUM            number of distinct keys in keyed and hash-map scenarios
+//   --conflict-rate=NUM   percentage of actions in keyed scenario that touch the same
+//                         hot key; the rest touch a random key
+//   --parallelism=NUM     number of helper threads for KeyedActionChain, number of
+//                         shards for ShardedActionChain and in hash-map scenario, and
+//                         number of pool threads in ordered-pipeline scenario
+//   --steps=NUM           number of steps per request in state-machine scenario
+//   --stages=NUM          number of stages in pipeline and ordered-pipeline scenarios
+//   --churn=NUM           number of actions per short-lived thread in thread-churn
+//                         scenario
+//   --workload=PATH       shared library with a custom workload for counter scenario;
+//                         see action_chain_workload.h
+//   --chains=NUM          number of chains in multi-chain and pool scenarios
+//   --chain-dist=DIST     distribution of chains picked by actions in multi-chain
+//                         scenario: uniform or zipf
+//   --batch=NUM           number of elements per batched operation in hash-map and
+//                         priority-queue scenarios and the number of additions per
+//                         flush of ThreadLocalAccumulator in accumulator scenario
+//   --fuse=NUM            number of actions per Run() call for ActionChainFused; from
+//                         1 to 8
+//   --state-bytes=NUM     size of the state guarded by the primitive in counter
+//                         scenario in addition to the counter
+//   --touch=NUM           number of cache lines of --state-bytes touched by every
+//                         action
+//   --access=PATTERN      which cache lines of --state-bytes actions touch: random or
+//                         strided (every action continues where the last one
+//                         stopped)
+//   --deadline-us=NUM     deadline of actions in overload scenario in microseconds
+//                         after they are submitted
+//   --linger=NUM          ActionChain::Options::linger_spins in bursty scenario
+//   --burst=NUM           number of back-to-back actions per burst in bursty scenario
+//                         and the maximum burst of actions in rate-limit scenario
+//   --rate=NUM            maximum number of actions per second in rate-limit
+//                         scenario; defaults to 10K
+//   --duration=TIME       run counter scenario for this long instead of performing
+//                         --actions actions
+//   --interval=TIME       how often to report throughput and latency of actions when
+//                         running for --duration; defaults to 1s
+//   --write-rate=NUM      percentage of actions in reclaim scenario that replace the
+//                         shared object; the rest read it
+//   --census=NUM          if not zero, print the census of action types after the
+//                         benchmark; requires building with `make CENSUS=1`
+//   --gap-ns=NUM          pause between bursts in bursty scenario and between actions
+//                         of quiet tenants in fair scenario in nanoseconds
+//
+// Scenarios:
+//
+//   counter               every action increments a shared counter --ops-per-action
+//                         times; with --state-bytes it also touches --touch cache
+//                         lines of a larger state and reports LLC misses if
+//                         perf_event_open(2) is available; supports all
+//                         synchronization primitives
+//   bounded-queue         --threads producers and --threads consumers pass --actions
+//                         items through a queue with --capacity elements; supports
+//                         ActionChain (RunWhen) and CriticalSection (mutex plus
+//                         condition variables)
+//   keyed                 every action touches one key; actions with the same key
+//                         must run in order; supports KeyedActionChain, ActionChain
+//                         (single chain for all keys) and ShardedActionChain (one
+//                         chain per shard of keys)
+//   state-machine         every request is a state machine that runs --steps actions
+//                         in sequence; --actions is the number of requests; supports
+//                         ActionChain (every step schedules the next with Run),
+//                         ActionChainRunNext (with RunNext), ActionChainRunWhen
+//                         (like ActionChainRunNext but requests are parked with
+//                         RunWhen() and released in pairs; fails if a parked action
+//                         runs ahead of continuations of the previous one) and
+//                         CriticalSection (locks once per step)
+//   pipeline              --stages chains where every action on a chain schedules an
+//                         action on the next chain; --actions is the number of items
+//                         entering the first stage; reports end-to-end latency,
+//                         throughput of every stage and the maximum stack depth of
+//                         actions; supports ActionChain, ActionChainTrampoline
+//                         (every thread has ActionChain::Trampoline), CriticalSection
+//                         (nested locks) and MutexQueue (a thread per stage that
+//                         takes items from a queue guarded by a mutex)
+//   thread-churn          like counter but each of --threads threads is replaced by
+//                         a sequence of short-lived threads issuing --churn actions
+//                         each; supports the same primitives as counter
+//   multi-chain           every action picks one of --chains instances of the
+//                         primitive according to --chain-dist and increments its
+//                         counter; reports allocations and drains per action;
+//                         supports ActionChain, ActionChainTLS and CriticalSection
+//   pool                  every action increments the counter of whichever of
+//                         --chains chains it runs on; reports load imbalance: the
+//                         number of actions on the busiest chain relative to the
+//                         average over --chains; supports PowerOfTwo
+//                         (ChainPool::RunAnywhere), RoundRobin (every thread cycles
+//                         through the chains) and ActionChain (all actions on one
+//                         chain, so its imbalance is --chains)
+//   ordered-pipeline      one thread submits --actions items to a pipeline of --stages
+//                         stages running on --parallelism threads; even stages are
+//                         parallel and perform --ops-per-action operations per item;
+//                         odd stages are serial and check that items arrive in the
+//                         order of submission; supports OrderedPipeline and
+//                         MutexReorder (serial stages reorder items in a priority
+//                         queue guarded by a mutex); requires --threads=1
+//   hash-map              half of the actions insert a random key out of --keys into a
+//                         hash map with --parallelism shards, the rest look up keys,
+//                         --batch keys per lookup; supports Delegated
+//                         (DelegatedHashMap) and CriticalSection (mutex per shard)
+//   priority-queue        every thread pushes --batch elements into a priority queue
+//                         and pops them with one operation, over and over; every push
+//                         and every popped element count as an action; supports
+//                         Delegated (DelegatedPriorityQueue) and CriticalSection
+//   deque                 every action pushes or pops an element at a random end of a
+//                         deque with --capacity elements; supports Delegated
+//                         (DelegatedBoundedDeque) and CriticalSection
+//   overload              like counter but the chain is held by another thread until
+//                         all actions have been submitted, so that they pile up;
+//                         reports latency of actions and recovery time: the time it
+//                         takes the chain to process the backlog once released;
+//                         supports ActionChain and ActionChainDeadline (actions that
+//                         haven't started within --deadline-us are dropped)
+//   many-types            every action is one of 64 distinct types that call the same
+//                         function with different arguments; reports L1 instruction
+//                         cache misses if perf_event_open(2) is available and the
+//                         size of the code that runs the actions; supports
+//                         ActionChain (a lambda per type) and ActionChainRunCall
+//                         (RunCall() with a context per type)
+//   heavy-capture         every action carries four 64-byte strings copied from the
+//                         caller; reports allocations and moves of the action per
+//                         action; supports ActionChain (Run() with a temporary) and
+//                         ActionChainEmplace (Emplace())
+//   accumulator           every action adds 1 to a shared sum; supports
+//                         ThreadLocalAccumulator (flushes every --batch additions),
+//                         Atomic (fetch_add) and ActionChain (one action per
+//                         addition)
+//   bursty                like counter but every thread submits actions in bursts of
+//                         --burst separated by --gap-ns of spinning; reports how
+//                         often consecutive actions run on different threads; run it
+//                         with different --linger and --gap-ns to see how lingering
+//                         pays off; supports ActionChain and CriticalSection
+//   fair                  like counter but every thread is a tenant; tenant 0 is noisy
+//                         and submits actions back to back while the others pause
+//                         for --gap-ns between actions; reports latency of noisy
+//                         and quiet tenants from Run() to the start of the action;
+//                         supports FairActionChain (equal weights) and ActionChain
+//                         (FIFO across tenants)
+//   reclaim               every thread reads a shared immutable object without locking;
+//                         --write-rate percent of actions replace it on a chain;
+//                         supports Reclaimer (raw pointer; old objects are retired to
+//                         Reclaimer and readers call Quiesce() after every read) and
+//                         SharedPtr (std::shared_ptr with std::atomic_load and
+//                         std::atomic_store)
+//   rate-limit            like counter but actions may run at most --rate per second
+//                         with bursts of up to --burst; by default --actions is
+//                         enough for one second; reports the achieved rate, its
+//                         deviation from --rate and latency of Run(); supports
+//                         RateLimitedActionChain and SleepInAction (ActionChain
+//                         whose actions sleep until the next token is available)
+//   cross-process         like counter but with --threads processes sharing a counter
+//                         in shared memory; supports SharedActionChain and
+//                         ProcessSharedMutex (pthread mutex with
+//                         PTHREAD_PROCESS_SHARED)
 //
 // Synchronization primitives:
 //
@@ -16,6 +175,8 @@
 //                         passing by the caller
 //   ActionChainTLS        ActionChain class from this library with implicit Mem
 //                         passing via TLS
+//   ActionChainFused      like ActionChain but passes --fuse actions to every Run()
+//                         call; counter scenario only
 //   CriticalSection       regular mutex
 //   Unsynchronized        no synchronization; set --threads=1 when you use this
 //
@@ -24,12 +185,38 @@
 //   K  multiply by 2^10
 //   M  multiply by 2^20
 //   G  multiply by 2^30
+//
+// Times must be integers with a unit: ns, us, ms, s, m or h.
 
 #include "action_chain.h"
+#include "action_chain_workload.h"
+#include "chain_pool.h"
+#include "delegated.h"
+#include "fair_action_chain.h"
+#include "keyed_action_chain.h"
+#include "ordered_pipeline.h"
+#include "rate_limited_action_chain.h"
+#include "reclaimer.h"
+#include "shared_action_chain.h"
+#include "thread_local_accumulator.h"
+#include "thread_pool.h"
 
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cctype>
 #include <charconv>
 #include <chrono>
@@ -37,11 +224,17 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <queue>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
 #include <utility>
@@ -57,12 +250,57 @@
 namespace romkatv {
 namespace {
 
+// The number of heap allocations performed by the current thread.
+thread_local std::uint64_t allocations = 0;
+
+}  // namespace
+}  // namespace romkatv
+
+// Not inlined to keep GCC from flagging free() of memory returned by operator new
+// and vice versa.
+__attribute__((noinline)) void* operator new(std::size_t size) {
+  ++romkatv::allocations;
+  if (void* p = std::malloc(size ? size : 1)) return p;
+  std::abort();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace romkatv {
+namespace {
+
 struct Flags {
+  std::string scenario = "counter";
   std::string sync = "ActionChain";
   std::uint64_t threads = 1;
   std::uint64_t ops_per_action = 1;
   // The default value is set in ParseFlags as it depends on other flags.
   std::uint64_t actions = 0;
+  std::uint64_t capacity = 1 << 10;
+  std::uint64_t keys = 1 << 10;
+  std::uint64_t conflict_rate = 0;
+  std::uint64_t parallelism = 4;
+  std::uint64_t steps = 8;
+  std::uint64_t stages = 3;
+  std::uint64_t churn = 16;
+  std::string workload;
+  std::uint64_t chains = 64;
+  std::string chain_dist = "uniform";
+  std::uint64_t batch = 1;
+  std::uint64_t fuse = 4;
+  std::uint64_t deadline_us = 1000;
+  std::uint64_t state_bytes = 0;
+  std::uint64_t touch = 1;
+  std::string access = "random";
+  std::uint64_t linger = 0;
+  std::uint64_t burst = 16;
+  std::uint64_t gap_ns = 1000;
+  std::uint64_t census = 0;
+  std::uint64_t write_rate = 1;
+  std::chrono::nanoseconds duration{0};
+  std::chrono::nanoseconds interval = std::chrono::seconds(1);
+  std::uint64_t rate = 10000;
 };
 
 void ParseFlag(std::uint64_t* flag, std::string_view s) {
@@ -87,6 +325,22 @@ void ParseFlag(std::uint64_t* flag, std::string_view s) {
 
 void ParseFlag(std::string* flag, std::string_view s) { *flag = std::string(s); }
 
+void ParseFlag(std::chrono::nanoseconds* flag, std::string_view s) {
+  static constexpr std::pair<std::string_view, std::chrono::nanoseconds> kUnits[] = {
+      {"ns", std::chrono::nanoseconds(1)}, {"us", std::chrono::microseconds(1)},
+      {"ms", std::chrono::milliseconds(1)}, {"s", std::chrono::seconds(1)},
+      {"m", std::chrono::minutes(1)},       {"h", std::chrono::hours(1)},
+  };
+  std::size_t n = 0;
+  while (n != s.size() && std::isdigit(s[n])) ++n;
+  std::uint64_t count;
+  CHECK(std::from_chars(s.data(), s.data() + n, count).ec == std::errc());
+  auto unit = std::find_if(std::begin(kUnits), std::end(kUnits),
+                           [&](const auto& u) { return u.first == s.substr(n); });
+  CHECK(unit != std::end(kUnits));
+  *flag = count * unit->second;
+}
+
 Flags ParseFlags(const char* const* begin, const char* const* end) {
   auto Match = [&](const char* name, auto* flag) -> bool {
     if (std::strncmp(*begin + 2, name, std::strlen(name))) return false;
@@ -106,11 +360,31 @@ Flags ParseFlags(const char* const* begin, const char* const* end) {
   Flags res;
   for (; begin != end; ++begin) {
     CHECK(!std::strncmp(*begin, "--", 2));
-    CHECK(Match("sync", &res.sync) || Match("actions", &res.actions) ||
-          Match("threads", &res.threads) || Match("ops-per-action", &res.ops_per_action));
+    CHECK(Match("scenario", &res.scenario) || Match("sync", &res.sync) ||
+          Match("actions", &res.actions) || Match("threads", &res.threads) ||
+          Match("ops-per-action", &res.ops_per_action) || Match("capacity", &res.capacity) ||
+          Match("keys", &res.keys) || Match("conflict-rate", &res.conflict_rate) ||
+          Match("parallelism", &res.parallelism) || Match("steps", &res.steps) ||
+          Match("stages", &res.stages) || Match("churn", &res.churn) ||
+          Match("workload", &res.workload) || Match("chains", &res.chains) ||
+          Match("chain-dist", &res.chain_dist) || Match("batch", &res.batch) ||
+          Match("fuse", &res.fuse) || Match("deadline-us", &res.deadline_us) ||
+          Match("state-bytes", &res.state_bytes) || Match("touch", &res.touch) ||
+          Match("access", &res.access) || Match("linger", &res.linger) ||
+          Match("burst", &res.burst) || Match("gap-ns", &res.gap_ns) ||
+          Match("census", &res.census) || Match("write-rate", &res.write_rate) ||
+          Match("duration", &res.duration) || Match("interval", &res.interval) ||
+          Match("rate", &res.rate));
   }
+  // ThreadPool and KeyedActionChain would silently run with one thread.
+  CHECK(res.parallelism > 0);
   if (!res.actions) {
-    res.actions = (128 / (res.ops_per_action / 32 + 1)) << 20;
+    if (res.scenario == "rate-limit") {
+      // One second worth of actions.
+      res.actions = res.rate / res.threads * res.threads;
+    } else {
+      res.actions = (128 / (res.ops_per_action / 32 + 1)) << 20;
+    }
   }
 
   return res;
@@ -153,74 +427,2786 @@ class Unsynchronized {
   }
 };
 
+// Fast non-cryptographic PRNG (xorshift64*).
+class Rng {
+ public:
+  explicit Rng(std::uint64_t seed) : state_(seed * 0x9E3779B97F4A7C15 | 1) {}
+
+  std::uint64_t Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545F4914F6CDD1D;
+  }
+
+  // Returns a random number in [0, n).
+  std::uint64_t Uniform(std::uint64_t n) {
+    return static_cast<std::uint64_t>((static_cast<unsigned __int128>(Next()) * n) >> 64);
+  }
+
+ private:
+  std::uint64_t state_;
+};
+
+// Includes terminated and waited-for child processes.
 double CpuTimeSec() {
   auto ToSec = [](const timeval& tv) { return tv.tv_sec + 1e-6 * tv.tv_usec; };
-  rusage usage = {};
-  CHECK(getrusage(RUSAGE_SELF, &usage) == 0);
-  return ToSec(usage.ru_utime) + ToSec(usage.ru_stime);
+  double res = 0;
+  for (int who : {RUSAGE_SELF, RUSAGE_CHILDREN}) {
+    rusage usage = {};
+    CHECK(getrusage(who, &usage) == 0);
+    res += ToSec(usage.ru_utime) + ToSec(usage.ru_stime);
+  }
+  return res;
 }
 
-template <class Sync>
-int Benchmark(const Flags& flags) {
-  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
-  CHECK(actions_per_thread * flags.threads == flags.actions);
-
-  auto PrintCol = [](const char* name, const auto& val) {
-    std::cout << name << '=' << std::setw(17) << std::setprecision(3) << std::left << val;
-  };
+template <class T>
+void PrintCol(const char* name, const T& val) {
+  std::cout << name << '=' << std::setw(17) << std::setprecision(3) << std::left << val << ' ';
+}
 
+void PrintHeader(const Flags& flags) {
+  PrintCol("scenario", flags.scenario);
   PrintCol("sync", flags.sync);
   PrintCol("threads", flags.threads);
   PrintCol("ops-per-action", flags.ops_per_action);
   std::cout << std::flush;
+}
 
-  volatile std::uint64_t counter = 0;
+struct Timing {
+  double wall;
+  double cpu;
+};
+
+// Runs `f` and returns its wall and CPU time in seconds.
+template <class F>
+Timing Measure(F&& f) {
   auto wall_time_start = std::chrono::high_resolution_clock::now();
   double cpu_time_start = CpuTimeSec();
-  {
-    std::mutex m;
+  std::forward<F>(f)();
+  double cpu_time_end = CpuTimeSec();
+  auto wall_time_end = std::chrono::high_resolution_clock::now();
+  return {std::chrono::duration<double>(wall_time_end - wall_time_start).count(),
+          cpu_time_end - cpu_time_start};
+}
+
+void PrintTiming(const Timing& t, std::uint64_t actions) {
+  PrintCol("total-wall-time(s)", t.wall);
+  PrintCol("wall-time-per-action(ns)", 1e9 * t.wall / actions);
+  PrintCol("cpu-time-per-action(ns)", 1e9 * t.cpu / actions);
+}
+
+// Prints percentiles of `latency` measured in nanoseconds.
+void PrintLatency(const char* name, std::vector<std::uint64_t> latency) {
+  if (latency.empty()) return;
+  std::sort(latency.begin(), latency.end());
+  auto Col = [&](const char* suffix, double q) {
+    std::string col = std::string(name) + suffix;
+    PrintCol(col.c_str(), 1e-3 * latency[static_cast<std::size_t>(q * (latency.size() - 1))]);
+  };
+  Col("-p50(us)", 0.5);
+  Col("-p99(us)", 0.99);
+  Col("-max(us)", 1);
+}
+
+#ifdef ROMKATV_ACTION_CHAIN_CENSUS
+// Prints action types that have run, the most frequent first, followed by the number
+// of actions per node size.
+void PrintCensus() {
+  std::map<std::size_t, std::uint64_t> node_sizes;
+  for (const ActionChain::TypeStats& t : ActionChain::Census()) {
+    if (!t.runs) continue;
+    node_sizes[t.node_size] += t.runs;
+    PrintCol("runs", t.runs);
+    PrintCol("size", t.size);
+    PrintCol("align", t.align);
+    PrintCol("node-size", t.node_size);
+    std::cout << "type=" << t.name << std::endl;
+  }
+  for (const auto& [size, runs] : node_sizes) {
+    PrintCol("node-size", size);
+    PrintCol("runs", runs);
+    std::cout << std::endl;
+  }
+}
+#endif
+
+// Counts hardware events of the current process and all threads it creates after
+// the counter. Threads' events are added to the total when they exit.
+class PerfCounter {
+ public:
+  // See perf_event_open(2) for `type` and `config`.
+  PerfCounter(std::uint32_t type, std::uint64_t config) {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  PerfCounter(PerfCounter&&) = delete;
+  ~PerfCounter() {
+    if (fd_ >= 0) {
+      CHECK(close(fd_) == 0);
+    }
+  }
+
+  // Returns nullopt if the counter is unavailable.
+  std::optional<std::uint64_t> Read() const {
+    std::uint64_t res;
+    if (fd_ < 0 || read(fd_, &res, sizeof(res)) != sizeof(res)) return std::nullopt;
+    return res;
+  }
+
+ private:
+  int fd_;
+};
+
+// Prints the number of events per action.
+void PrintPerAction(const char* name, const PerfCounter& counter, std::uint64_t actions) {
+  if (std::optional<std::uint64_t> n = counter.Read()) {
+    PrintCol(name, 1. * *n / actions);
+  } else {
+    PrintCol(name, "n/a");
+  }
+}
+
+// State guarded by the primitive in counter scenario with --state-bytes.
+class State {
+ public:
+  explicit State(const Flags& flags)
+      : lines_(flags.state_bytes / kLineSize),
+        touch_(flags.touch),
+        random_(flags.access == "random"),
+        ops_per_action_(flags.ops_per_action) {
+    CHECK(lines_ > 0);
+    CHECK(flags.access == "random" || flags.access == "strided");
+    words_.reset(new std::uint64_t[lines_ * kWordsPerLine]());
+  }
+
+  std::uint64_t ops_per_action() const { return ops_per_action_; }
+
+  // Must be called under the lock.
+  void Touch() {
+    for (std::uint64_t i = 0; i != touch_; ++i) {
+      std::uint64_t line;
+      if (random_) {
+        line = rng_.Uniform(lines_);
+      } else {
+        line = next_;
+        if (++next_ == lines_) next_ = 0;
+      }
+      ++words_[line * kWordsPerLine];
+    }
+  }
+
+  // Returns the total number of touches.
+  std::uint64_t Sum() const {
+    std::uint64_t res = 0;
+    for (std::uint64_t i = 0; i != lines_; ++i) res += words_[i * kWordsPerLine];
+    return res;
+  }
+
+ private:
+  static constexpr std::uint64_t kLineSize = 64;
+  static constexpr std::uint64_t kWordsPerLine = kLineSize / sizeof(std::uint64_t);
+
+  std::unique_ptr<std::uint64_t[]> words_;
+  std::uint64_t lines_;
+  std::uint64_t touch_;
+  bool random_;
+  Rng rng_{1};
+  std::uint64_t next_ = 0;
+  std::uint64_t ops_per_action_;
+};
+
+// Workload loaded from a shared library. See action_chain_workload.h.
+class Plugin {
+ public:
+  explicit Plugin(const std::string& path) {
+    lib_ = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!lib_) {
+      std::cerr << "FATAL: " << dlerror() << std::endl;
+      std::abort();
+    }
+    Load(&init, "action_chain_workload_init");
+    Load(&run, "action_chain_workload_run");
+    Load(&verify, "action_chain_workload_verify");
+    Load(&teardown, "action_chain_workload_teardown");
+  }
+
+  Plugin(Plugin&&) = delete;
+  ~Plugin() { CHECK(dlclose(lib_) == 0); }
+
+  decltype(&action_chain_workload_init) init;
+  decltype(&action_chain_workload_run) run;
+  decltype(&action_chain_workload_verify) verify;
+  decltype(&action_chain_workload_teardown) teardown;
+
+ private:
+  template <class F>
+  void Load(F* f, const char* name) {
+    *f = reinterpret_cast<F>(dlsym(lib_, name));
+    if (!*f) {
+      std::cerr << "FATAL: " << dlerror() << std::endl;
+      std::abort();
+    }
+  }
+
+  void* lib_;
+};
+
+template <class Sync>
+int PluginBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+
+  PrintHeader(flags);
+  PrintCol("workload", flags.workload);
+  std::cout << std::flush;
+
+  Plugin plugin(flags.workload);
+  void* ctx = plugin.init(flags.threads);
+
+  // Actions capture a pointer to this, so that they fit into ActionChain nodes. It
+  // must outlive the threads: their actions may run after they exit.
+  struct Context {
+    Plugin* plugin;
+    void* ctx;
+    std::uint64_t thread_index;
+  };
+  std::vector<Context> contexts;
+  for (std::uint64_t t = 0; t != flags.threads; ++t) contexts.push_back({&plugin, ctx, t});
+
+  Timing timing = Measure([&] {
+    Sync sync;
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, c = &contexts[t]] {
+        typename Sync::Mem mem;
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          sync.Run(&mem, [c] { c->plugin->run(c->ctx, c->thread_index); });
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  int verified = plugin.verify(ctx, flags.actions);
+  plugin.teardown(ctx);
+  if (verified) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// Counter scenario with --duration.
+template <class Sync>
+int TimedBenchmark(const Flags& flags) {
+  // Latency is measured for one action out of this many.
+  constexpr std::uint64_t kLatencySamplePeriod = 64;
+
+  CHECK(flags.workload.empty() && !flags.state_bytes);
+  CHECK(flags.interval.count() > 0);
+
+  using Seconds = std::chrono::duration<double>;
+  PrintHeader(flags);
+  PrintCol("duration(s)", Seconds(flags.duration).count());
+  PrintCol("interval(s)", Seconds(flags.interval).count());
+  std::cout << std::endl;
+
+  struct alignas(64) ThreadStats {
+    // Written only by the thread.
+    std::atomic<std::uint64_t> actions{0};
+    std::mutex mutex;
+    // Latency of sampled actions since the last report. Guarded by mutex.
+    std::vector<std::uint64_t> latency;
+  };
+  std::unique_ptr<ThreadStats[]> stats(new ThreadStats[flags.threads]);
+  volatile std::uint64_t counter = 0;
+  std::atomic<bool> stop{false};
+
+  Timing timing = Measure([&] {
+    Sync sync;
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, s = &stats[t]] {
+        typename Sync::Mem mem;
+        for (std::uint64_t i = 0; !stop.load(std::memory_order_relaxed); ++i) {
+          if (i % kLatencySamplePeriod == 0) {
+            auto start = std::chrono::steady_clock::now();
+            sync.Run(&mem, [&, s, start] {
+              std::chrono::nanoseconds d = std::chrono::steady_clock::now() - start;
+              {
+                std::lock_guard lock(s->mutex);
+                s->latency.push_back(d.count());
+              }
+              for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++counter;
+            });
+          } else {
+            sync.Run(&mem, [&] {
+              for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++counter;
+            });
+          }
+          s->actions.store(i + 1, std::memory_order_relaxed);
+        }
+      });
+    }
+
+    auto last = std::chrono::steady_clock::now();
+    const auto end = last + flags.duration;
+    auto deadline = last;
+    std::uint64_t last_actions = 0;
+    for (std::uint64_t k = 1; deadline != end; ++k) {
+      deadline = std::min(deadline + flags.interval, end);
+      std::this_thread::sleep_until(deadline);
+      auto now = std::chrono::steady_clock::now();
+      std::uint64_t actions = 0;
+      std::vector<std::uint64_t> latency;
+      for (std::uint64_t t = 0; t != flags.threads; ++t) {
+        actions += stats[t].actions.load(std::memory_order_relaxed);
+        std::lock_guard lock(stats[t].mutex);
+        latency.insert(latency.end(), stats[t].latency.begin(), stats[t].latency.end());
+        stats[t].latency.clear();
+      }
+      PrintCol("interval", k);
+      PrintCol("actions-per-sec", (actions - last_actions) / Seconds(now - last).count());
+      PrintLatency("latency", std::move(latency));
+      std::cout << std::endl;
+      last = now;
+      last_actions = actions;
+    }
+
+    stop.store(true, std::memory_order_relaxed);
+    for (std::thread& t : threads) t.join();
+  });
+
+  std::uint64_t actions = 0;
+  for (std::uint64_t t = 0; t != flags.threads; ++t) actions += stats[t].actions.load();
+  if (counter != flags.ops_per_action * actions) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintCol("actions", actions);
+  PrintTiming(timing, actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+template <class Sync>
+int Benchmark(const Flags& flags) {
+  if (flags.duration.count()) return TimedBenchmark<Sync>(flags);
+  if (!flags.workload.empty()) return PluginBenchmark<Sync>(flags);
+
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+
+  PrintHeader(flags);
+  std::optional<State> state;
+  if (flags.state_bytes) {
+    PrintCol("state-bytes", flags.state_bytes);
+    PrintCol("touch", flags.touch);
+    PrintCol("access", flags.access);
+    std::cout << std::flush;
+    state.emplace(flags);
+  }
+
+  volatile std::uint64_t counter = 0;
+  PerfCounter llc(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  Timing timing = Measure([&] {
     Sync sync;
     std::vector<std::thread> threads;
     for (std::uint64_t i = 0; i != flags.threads; ++i) {
       threads.emplace_back([&] {
         typename Sync::Mem mem;
         for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
-          sync.Run(&mem, [&] {
-            for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++counter;
-          });
+          if (state) {
+            sync.Run(&mem, [&counter, s = &*state] {
+              for (std::uint64_t j = 0; j != s->ops_per_action(); ++j) ++counter;
+              s->Touch();
+            });
+          } else {
+            sync.Run(&mem, [&] {
+              for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++counter;
+            });
+          }
         }
       });
     }
     for (std::thread& t : threads) t.join();
+  });
+
+  if (counter != flags.ops_per_action * flags.actions ||
+      (state && state->Sum() != flags.touch * flags.actions)) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
   }
-  double cpu_time_end = CpuTimeSec();
-  auto wall_time_end = std::chrono::high_resolution_clock::now();
+
+  PrintTiming(timing, flags.actions);
+  if (state) {
+    PrintCol("actions-per-sec", flags.actions / timing.wall);
+    PrintPerAction("llc-misses-per-action", llc, flags.actions);
+  }
+  std::cout << std::endl;
+
+  return 0;
+}
+
+template <class F, std::size_t... I>
+void RunFused(ActionChain* chain, ActionChain::Mem* mem, const F& f, std::index_sequence<I...>) {
+  chain->Run(mem, (static_cast<void>(I), f)...);
+}
+
+// Like Benchmark<ActionChain> but passes N actions to every Run() call.
+template <std::size_t N>
+int FusedBenchmark(const Flags& flags) {
+  CHECK(flags.workload.empty());
+  const std::uint64_t runs_per_thread = flags.actions / flags.threads / N;
+  CHECK(runs_per_thread * flags.threads * N == flags.actions);
+
+  PrintHeader(flags);
+  PrintCol("fuse", N);
+  std::cout << std::flush;
+
+  volatile std::uint64_t counter = 0;
+  std::atomic<std::uint64_t> total_allocations{0};
+  Timing timing = Measure([&] {
+    ActionChain chain;
+    std::vector<std::thread> threads;
+    for (std::uint64_t i = 0; i != flags.threads; ++i) {
+      threads.emplace_back([&] {
+        std::uint64_t allocations_start = allocations;
+        {
+          ActionChain::Mem mem;
+          auto action = [&] {
+            for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++counter;
+          };
+          for (std::uint64_t i = 0; i != runs_per_thread; ++i) {
+            RunFused(&chain, &mem, action, std::make_index_sequence<N>());
+          }
+        }
+        total_allocations.fetch_add(allocations - allocations_start, std::memory_order_relaxed);
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
 
   if (counter != flags.ops_per_action * flags.actions) {
     std::cerr << "TEST FAILURE" << std::endl;
     return 1;
   }
 
-  double wall = std::chrono::duration<double>(wall_time_end - wall_time_start).count();
-  double cpu = cpu_time_end - cpu_time_start;
-  PrintCol("total-wall-time(s)", wall);
-  PrintCol("wall-time-per-action(ns)", 1e9 * wall / flags.actions);
-  PrintCol("cpu-time-per-action(ns)", 1e9 * cpu / flags.actions);
+  PrintTiming(timing, flags.actions);
+  PrintCol("allocations-per-action", 1. * total_allocations.load() / flags.actions);
   std::cout << std::endl;
 
   return 0;
 }
 
-int BenchmarkMain(int argc, char* argv[]) {
-  Flags flags = ParseFlags(argv + 1, argv + argc);
-  std::unordered_map<std::string, int (*)(const Flags&)> bm = {
-      {"ActionChain", Benchmark<ActionChain>},
-      {"ActionChainTLS", Benchmark<ActionChainTLS>},
-      {"CriticalSection", Benchmark<CriticalSection>},
-      {"Unsynchronized", Benchmark<Unsynchronized>},
-  };
-  CHECK(bm[flags.sync]);
-  return bm[flags.sync](flags);
+int FusedBenchmark(const Flags& flags) {
+  static constexpr int (*kBenchmarks[])(const Flags&) = {
+      FusedBenchmark<1>, FusedBenchmark<2>, FusedBenchmark<3>, FusedBenchmark<4>,
+      FusedBenchmark<5>, FusedBenchmark<6>, FusedBenchmark<7>, FusedBenchmark<8>,
+  };
+  CHECK(flags.fuse >= 1 && flags.fuse <= std::size(kBenchmarks));
+  return kBenchmarks[flags.fuse - 1](flags);
+}
+
+// The number of distinct action types in many-types scenario.
+constexpr std::size_t kManyTypes = 64;
+
+struct ManyTypes {
+  volatile std::uint64_t counter = 0;
+  std::uint64_t tags = 0;
+  std::uint64_t ops_per_action;
+  // Contexts for RunCall().
+  struct Tagged {
+    ManyTypes* m;
+    std::uint64_t tag;
+  } tagged[kManyTypes];
+};
+
+// Called by all actions in many-types scenario. Not inlined, like most functions that
+// actions call in real programs.
+__attribute__((noinline)) void Bump(ManyTypes* m, std::uint64_t tag) {
+  for (std::uint64_t j = 0; j != m->ops_per_action; ++j) ++m->counter;
+  m->tags += tag;
+}
+
+void BumpTagged(void* ctx) {
+  auto* t = static_cast<ManyTypes::Tagged*>(ctx);
+  Bump(t->m, t->tag);
+}
+
+template <bool kCall, std::size_t I>
+void RunTyped(ActionChain* chain, ActionChain::Mem* mem, ManyTypes* m) {
+  if constexpr (kCall) {
+    chain->RunCall(mem, &BumpTagged, &m->tagged[I]);
+  } else {
+    chain->Run(mem, [m] { Bump(m, I); });
+  }
+}
+
+template <bool kCall, std::size_t... I>
+constexpr auto RunTypedTable(std::index_sequence<I...>) {
+  return std::array<void (*)(ActionChain*, ActionChain::Mem*, ManyTypes*), sizeof...(I)>{
+      &RunTyped<kCall, I>...};
+}
+
+// Returns the total size of the code of ActionChain::Work::Invoke() instantiations
+// whose mangled names contain `tag`, according to the symbol table of this binary.
+// Returns nullopt if the binary has no symbol table.
+std::optional<std::uint64_t> InvokeTextBytes(std::string_view tag) {
+  int fd = open("/proc/self/exe", O_RDONLY);
+  CHECK(fd >= 0);
+  struct stat st;
+  CHECK(fstat(fd, &st) == 0);
+  void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  CHECK(p != MAP_FAILED);
+  CHECK(close(fd) == 0);
+
+  const char* base = static_cast<const char*>(p);
+  auto* ehdr = reinterpret_cast<const ElfW(Ehdr)*>(base);
+  auto* shdrs = reinterpret_cast<const ElfW(Shdr)*>(base + ehdr->e_shoff);
+  std::optional<std::uint64_t> res;
+  for (std::size_t i = 0; i != ehdr->e_shnum; ++i) {
+    if (shdrs[i].sh_type != SHT_SYMTAB) continue;
+    auto* syms = reinterpret_cast<const ElfW(Sym)*>(base + shdrs[i].sh_offset);
+    const char* names = base + shdrs[shdrs[i].sh_link].sh_offset;
+    res = 0;
+    for (std::size_t j = 0; j != shdrs[i].sh_size / sizeof(ElfW(Sym)); ++j) {
+      if (ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC) continue;
+      std::string_view name = names + syms[j].st_name;
+      if (name.find("ActionChain4Work6InvokeI") != std::string_view::npos &&
+          name.find(tag) != std::string_view::npos) {
+        *res += syms[j].st_size;
+      }
+    }
+  }
+  CHECK(munmap(p, st.st_size) == 0);
+  return res;
+}
+
+template <bool kCall>
+int ManyTypesBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+
+  PrintHeader(flags);
+  PrintCol("types", kManyTypes);
+  std::cout << std::flush;
+
+  static constexpr auto kRun = RunTypedTable<kCall>(std::make_index_sequence<kManyTypes>());
+  ManyTypes m;
+  m.ops_per_action = flags.ops_per_action;
+  for (std::uint64_t i = 0; i != kManyTypes; ++i) m.tagged[i] = {&m, i};
+  std::atomic<std::uint64_t> expected_tags{0};
+
+  PerfCounter l1i(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I |
+                                          PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                          PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  Timing timing = Measure([&] {
+    ActionChain chain;
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        ActionChain::Mem mem;
+        Rng rng(t + 1);
+        std::uint64_t tags = 0;
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          std::uint64_t type = rng.Uniform(kManyTypes);
+          tags += type;
+          kRun[type](&chain, &mem, &m);
+        }
+        expected_tags.fetch_add(tags, std::memory_order_relaxed);
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  if (m.counter != flags.ops_per_action * flags.actions || m.tags != expected_tags.load()) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintPerAction("l1i-misses-per-action", l1i, flags.actions);
+  // The code the drainer runs for the actions, not counting Bump().
+  if (std::optional<std::uint64_t> n =
+          InvokeTextBytes(kCall ? "4CallE" : "RunTypedILb0E")) {
+    PrintCol("invoke-text-bytes", *n);
+  } else {
+    PrintCol("invoke-text-bytes", "n/a");
+  }
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// The number of times HeavyAction has been moved on the current thread.
+thread_local std::uint64_t heavy_moves = 0;
+
+// Action with several strings that don't fit into the small string buffer.
+class HeavyAction {
+ public:
+  HeavyAction(volatile std::uint64_t* counter, const std::string& a, const std::string& b,
+              const std::string& c, const std::string& d)
+      : counter_(counter), s_{a, b, c, d} {}
+
+  HeavyAction(HeavyAction&& other) : counter_(other.counter_), s_(std::move(other.s_)) {
+    ++heavy_moves;
+  }
+
+  void operator()() {
+    for (const std::string& s : s_) *counter_ += s.size();
+  }
+
+ private:
+  volatile std::uint64_t* counter_;
+  std::array<std::string, 4> s_;
+};
+
+template <bool kEmplace>
+int HeavyCaptureBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+
+  PrintHeader(flags);
+  std::cout << std::flush;
+
+  const std::string str(64, 'x');
+  volatile std::uint64_t counter = 0;
+  std::atomic<std::uint64_t> total_allocations{0};
+  std::atomic<std::uint64_t> total_moves{0};
+
+  Timing timing = Measure([&] {
+    ActionChain chain;
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&] {
+        std::uint64_t allocations_start = allocations;
+        std::uint64_t moves_start = heavy_moves;
+        {
+          ActionChain::Mem mem;
+          for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+            if (kEmplace) {
+              chain.Emplace<HeavyAction>(&mem, &counter, str, str, str, str);
+            } else {
+              chain.Run(&mem, HeavyAction(&counter, str, str, str, str));
+            }
+          }
+        }
+        total_allocations.fetch_add(allocations - allocations_start, std::memory_order_relaxed);
+        total_moves.fetch_add(heavy_moves - moves_start, std::memory_order_relaxed);
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  if (counter != 4 * str.size() * flags.actions) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("allocations-per-action", 1. * total_allocations.load() / flags.actions);
+  PrintCol("moves-per-action", 1. * total_moves.load() / flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+class AccumulatorSync {
+ public:
+  class Local {
+   public:
+    explicit Local(AccumulatorSync* sync) : local_(&sync->acc_) {}
+    void Add(std::uint64_t x) { local_.Add(x); }
+
+   private:
+    ThreadLocalAccumulator<std::uint64_t>::Local local_;
+  };
+
+  explicit AccumulatorSync(const Flags& flags) : acc_({flags.batch}) {}
+
+  std::uint64_t Read() {
+    std::uint64_t res = 0;
+    acc_.Read([&](std::uint64_t sum) { res = sum; });
+    return res;
+  }
+
+ private:
+  ThreadLocalAccumulator<std::uint64_t> acc_;
+};
+
+class AtomicAccumulatorSync {
+ public:
+  class Local {
+   public:
+    explicit Local(AtomicAccumulatorSync* sync) : sum_(&sync->sum_) {}
+    void Add(std::uint64_t x) { sum_->fetch_add(x, std::memory_order_relaxed); }
+
+   private:
+    std::atomic<std::uint64_t>* sum_;
+  };
+
+  explicit AtomicAccumulatorSync(const Flags&) {}
+  std::uint64_t Read() { return sum_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<std::uint64_t> sum_{0};
+};
+
+class ChainAccumulatorSync {
+ public:
+  class Local {
+   public:
+    explicit Local(ChainAccumulatorSync* sync) : sync_(sync) {}
+    void Add(std::uint64_t x) {
+      sync_->chain_.Run(&mem_, [sync = sync_, x] { sync->sum_ += x; });
+    }
+
+   private:
+    ChainAccumulatorSync* sync_;
+    ActionChain::Mem mem_;
+  };
+
+  explicit ChainAccumulatorSync(const Flags&) {}
+  std::uint64_t Read() { return sum_; }
+
+ private:
+  std::uint64_t sum_ = 0;
+  ActionChain chain_;
+};
+
+template <class Sync>
+int AccumulatorBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+  CHECK(flags.batch > 0);
+
+  PrintHeader(flags);
+  PrintCol("batch", flags.batch);
+  std::cout << std::flush;
+
+  Sync sync(flags);
+  Timing timing = Measure([&] {
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&] {
+        typename Sync::Local local(&sync);
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) local.Add(1);
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  if (sync.Read() != flags.actions) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// State of overload scenario. Written by actions.
+struct Overload {
+  std::uint64_t Now() const {
+    return std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count();
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::uint64_t ops_per_action;
+  volatile std::uint64_t counter = 0;
+  // Latency of every action that has run.
+  std::vector<std::uint64_t> latency;
+  std::uint64_t expired = 0;
+  // When all actions had been submitted and when the last action has run or expired,
+  // measured from `start`.
+  std::uint64_t spike_end_ns = 0;
+  std::uint64_t done_ns = 0;
+};
+
+template <bool kShed>
+int OverloadBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+
+  PrintHeader(flags);
+  if (kShed) PrintCol("deadline-us", flags.deadline_us);
+  std::cout << std::flush;
+
+  Overload o;
+  o.ops_per_action = flags.ops_per_action;
+  o.latency.reserve(flags.actions);
+  const std::chrono::microseconds ttl(flags.deadline_us);
+
+  Timing timing = Measure([&] {
+    ActionChain chain;
+    std::atomic<bool> go{false};
+    std::atomic<std::uint64_t> finished{0};
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&] {
+        while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+        ActionChain::Mem mem;
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          std::uint64_t submitted = o.Now();
+          auto action = [&o, submitted] {
+            for (std::uint64_t j = 0; j != o.ops_per_action; ++j) ++o.counter;
+            o.done_ns = o.Now();
+            o.latency.push_back(o.done_ns - submitted);
+          };
+          if (kShed) {
+            auto deadline = o.start + std::chrono::nanoseconds(submitted) + ttl;
+            chain.RunWithDeadline(&mem, deadline, action, [&o] {
+              ++o.expired;
+              o.done_ns = o.Now();
+            });
+          } else {
+            chain.Run(&mem, action);
+          }
+        }
+        finished.fetch_add(1, std::memory_order_release);
+      });
+    }
+    // Holds the chain until all actions have been submitted. They will run on this thread.
+    chain.Run([&] {
+      go.store(true, std::memory_order_release);
+      while (finished.load(std::memory_order_acquire) != flags.threads) std::this_thread::yield();
+      o.spike_end_ns = o.Now();
+    });
+    for (std::thread& t : threads) t.join();
+  });
+
+  if (o.latency.size() + o.expired != flags.actions ||
+      o.counter != flags.ops_per_action * o.latency.size()) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("expired", o.expired);
+  PrintLatency("latency", std::move(o.latency));
+  PrintCol("recovery-time(ms)", 1e-6 * (o.done_ns - o.spike_end_ns));
+  std::cout << std::endl;
+
+  return 0;
+}
+
+template <class Sync>
+int ThreadChurnBenchmark(const Flags& flags) {
+  const std::uint64_t threads_per_slot = flags.actions / flags.threads / flags.churn;
+  CHECK(threads_per_slot * flags.threads * flags.churn == flags.actions);
+
+  PrintHeader(flags);
+  PrintCol("churn", flags.churn);
+  std::cout << std::flush;
+
+  volatile std::uint64_t counter = 0;
+  Timing timing = Measure([&] {
+    Sync sync;
+    std::vector<std::thread> slots;
+    for (std::uint64_t i = 0; i != flags.threads; ++i) {
+      slots.emplace_back([&] {
+        for (std::uint64_t i = 0; i != threads_per_slot; ++i) {
+          std::thread([&] {
+            typename Sync::Mem mem;
+            for (std::uint64_t i = 0; i != flags.churn; ++i) {
+              sync.Run(&mem, [&] {
+                for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++counter;
+              });
+            }
+          }).join();
+        }
+      });
+    }
+    for (std::thread& t : slots) t.join();
+  });
+
+  if (counter != flags.ops_per_action * flags.actions) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("wall-time-per-thread(ns)", 1e9 * timing.wall * flags.churn / flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// Bounded FIFO queue built on ActionChain::RunWhen(). Neither Push() nor Pop() block.
+class ChainBoundedQueue {
+ public:
+  using Mem = ActionChain::Mem;
+
+  explicit ChainBoundedQueue(std::size_t capacity) : capacity_(capacity) {}
+
+  void Push(Mem* mem, std::uint64_t x) {
+    chain_.RunWhen(
+        mem, &not_full_, [this] { return queue_.size() < capacity_; },
+        [this, x] {
+          queue_.push_back(x);
+          chain_.Notify(&not_empty_);
+        });
+  }
+
+  // Calls `sink` with the popped element. `sink` is invoked on the chain.
+  template <class F>
+  void Pop(Mem* mem, F&& sink) {
+    chain_.RunWhen(
+        mem, &not_empty_, [this] { return !queue_.empty(); },
+        [this, sink = std::forward<F>(sink)] {
+          sink(queue_.front());
+          queue_.pop_front();
+          chain_.Notify(&not_full_);
+        });
+  }
+
+ private:
+  const std::size_t capacity_;
+  std::deque<std::uint64_t> queue_;
+  ActionChain::Condition not_full_;
+  ActionChain::Condition not_empty_;
+  ActionChain chain_;
+};
+
+// Bounded FIFO queue built on a mutex and condition variables. Push() blocks while the
+// queue is full and Pop() blocks while it's empty.
+class CondVarBoundedQueue {
+ public:
+  using Mem = int;
+
+  explicit CondVarBoundedQueue(std::size_t capacity) : capacity_(capacity) {}
+
+  void Push(Mem*, std::uint64_t x) {
+    std::unique_lock lock(mutex_);
+    not_full_.wait(lock, [&] { return queue_.size() < capacity_; });
+    queue_.push_back(x);
+    not_empty_.notify_one();
+  }
+
+  template <class F>
+  void Pop(Mem*, F&& sink) {
+    std::unique_lock lock(mutex_);
+    not_empty_.wait(lock, [&] { return !queue_.empty(); });
+    sink(queue_.front());
+    queue_.pop_front();
+    not_full_.notify_one();
+  }
+
+ private:
+  const std::size_t capacity_;
+  std::deque<std::uint64_t> queue_;
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+};
+
+template <class Queue>
+int BoundedQueueBenchmark(const Flags& flags) {
+  const std::uint64_t items_per_thread = flags.actions / flags.threads;
+  CHECK(items_per_thread * flags.threads == flags.actions);
+  CHECK(flags.capacity > 0);
+
+  PrintHeader(flags);
+  PrintCol("capacity", flags.capacity);
+  std::cout << std::flush;
+
+  // Only accessed from Pop() sinks, which are serialized by the queue.
+  std::uint64_t sum = 0;
+  Timing timing = Measure([&] {
+    Queue queue(flags.capacity);
+    std::vector<std::thread> threads;
+    for (std::uint64_t i = 0; i != flags.threads; ++i) {
+      threads.emplace_back([&] {
+        typename Queue::Mem mem;
+        for (std::uint64_t i = 0; i != items_per_thread; ++i) queue.Push(&mem, i);
+      });
+      threads.emplace_back([&] {
+        typename Queue::Mem mem;
+        for (std::uint64_t i = 0; i != items_per_thread; ++i) {
+          queue.Pop(&mem, [&](std::uint64_t x) { sum += x; });
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  if (sum != flags.threads * (items_per_thread * (items_per_thread - 1) / 2)) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+class KeyedChainSync {
+ public:
+  using Mem = int;
+
+  explicit KeyedChainSync(const Flags& flags) : chain_(flags.parallelism) {}
+
+  template <class F>
+  void Run(Mem*, std::uint64_t key, F&& f) {
+    chain_.Run({key}, std::forward<F>(f));
+  }
+
+ private:
+  KeyedActionChain chain_;
+};
+
+class SingleChainSync {
+ public:
+  using Mem = ActionChain::Mem;
+
+  explicit SingleChainSync(const Flags&) {}
+
+  template <class F>
+  void Run(Mem* mem, std::uint64_t, F&& f) {
+    chain_.Run(mem, std::forward<F>(f));
+  }
+
+ private:
+  ActionChain chain_;
+};
+
+// Doesn't preserve the order of actions with different keys.
+class ShardedChainSync {
+ public:
+  using Mem = ActionChain::Mem;
+
+  explicit ShardedChainSync(const Flags& flags)
+      : shards_(new ActionChain[flags.parallelism]), num_shards_(flags.parallelism) {}
+
+  template <class F>
+  void Run(Mem* mem, std::uint64_t key, F&& f) {
+    shards_[key % num_shards_].Run(mem, std::forward<F>(f));
+  }
+
+ private:
+  std::unique_ptr<ActionChain[]> shards_;
+  std::uint64_t num_shards_;
+};
+
+template <class Sync>
+int KeyedBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+  CHECK(flags.keys > 0 && flags.conflict_rate <= 100 && flags.parallelism > 0);
+
+  PrintHeader(flags);
+  PrintCol("keys", flags.keys);
+  PrintCol("conflict-rate(%)", flags.conflict_rate);
+  PrintCol("parallelism", flags.parallelism);
+  std::cout << std::flush;
+
+  // Actions capture only a pointer to KeyState and a packed (thread, index) pair,
+  // so that they fit into ActionChain nodes.
+  struct alignas(64) KeyState {
+    volatile std::uint64_t counter = 0;
+    std::uint64_t ops_per_action;
+    bool ordered = true;
+    // The index of the last action executed by every thread for this key.
+    std::vector<std::uint64_t> last;
+  };
+  std::vector<KeyState> state(flags.keys);
+  for (KeyState& s : state) {
+    s.ops_per_action = flags.ops_per_action;
+    s.last.assign(flags.threads, 0);
+  }
+
+  Timing timing = Measure([&] {
+    Sync sync(flags);
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        typename Sync::Mem mem;
+        Rng rng(t + 1);
+        for (std::uint64_t i = 1; i <= actions_per_thread; ++i) {
+          std::uint64_t key = rng.Uniform(100) < flags.conflict_rate || flags.keys == 1
+                                  ? 0
+                                  : 1 + rng.Uniform(flags.keys - 1);
+          KeyState* s = &state[key];
+          sync.Run(&mem, key, [s, ti = t << 48 | i] {
+            std::uint64_t& last = s->last[ti >> 48];
+            if (last >= (ti & ((1ull << 48) - 1))) s->ordered = false;
+            last = ti & ((1ull << 48) - 1);
+            for (std::uint64_t j = 0; j != s->ops_per_action; ++j) ++s->counter;
+          });
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  std::uint64_t total = 0;
+  bool ordered = true;
+  for (const KeyState& s : state) {
+    total += s.counter;
+    ordered &= s.ordered;
+  }
+  if (total != flags.ops_per_action * flags.actions || !ordered) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// Index of the current benchmark thread.
+thread_local std::uint64_t thread_index = 0;
+
+// Picks chains according to --chain-dist.
+class ChainPicker {
+ public:
+  explicit ChainPicker(const Flags& flags) {
+    CHECK(flags.chains > 0);
+    CHECK(flags.chain_dist == "uniform" || flags.chain_dist == "zipf");
+    if (flags.chain_dist == "zipf") {
+      // P(i) is proportional to 1 / (i + 1).
+      double sum = 0;
+      for (std::uint64_t i = 0; i != flags.chains; ++i) cdf_.push_back(sum += 1. / (i + 1));
+      for (double& x : cdf_) x /= sum;
+    }
+    n_ = flags.chains;
+  }
+
+  std::uint64_t Pick(Rng& rng) const {
+    if (cdf_.empty()) return rng.Uniform(n_);
+    double x = (rng.Next() >> 11) * 0x1p-53;
+    return std::min<std::uint64_t>(std::upper_bound(cdf_.begin(), cdf_.end(), x) - cdf_.begin(),
+                                   n_ - 1);
+  }
+
+ private:
+  std::uint64_t n_;
+  std::vector<double> cdf_;
+};
+
+template <class Sync>
+int MultiChainBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+
+  PrintHeader(flags);
+  PrintCol("chains", flags.chains);
+  PrintCol("chain-dist", flags.chain_dist);
+  std::cout << std::flush;
+
+  struct alignas(64) Chain {
+    Sync sync;
+    volatile std::uint64_t counter = 0;
+    // The number of actions that ran on the thread that scheduled them. Every drain
+    // of an ActionChain starts with such an action and has no others.
+    std::uint64_t drains = 0;
+    std::uint64_t ops_per_action;
+  };
+  std::unique_ptr<Chain[]> chains(new Chain[flags.chains]);
+  for (std::uint64_t i = 0; i != flags.chains; ++i) {
+    chains[i].ops_per_action = flags.ops_per_action;
+  }
+  ChainPicker picker(flags);
+  std::atomic<std::uint64_t> total_allocations{0};
+
+  Timing timing = Measure([&] {
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        thread_index = t;
+        std::uint64_t allocations_start = allocations;
+        {
+          typename Sync::Mem mem;
+          Rng rng(t + 1);
+          for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+            Chain* c = &chains[picker.Pick(rng)];
+            c->sync.Run(&mem, [c, t] {
+              c->drains += t == thread_index;
+              for (std::uint64_t j = 0; j != c->ops_per_action; ++j) ++c->counter;
+            });
+          }
+        }
+        total_allocations.fetch_add(allocations - allocations_start, std::memory_order_relaxed);
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  std::uint64_t counter = 0;
+  std::uint64_t drains = 0;
+  for (std::uint64_t i = 0; i != flags.chains; ++i) {
+    counter += chains[i].counter;
+    drains += chains[i].drains;
+  }
+  if (counter != flags.ops_per_action * flags.actions) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("actions-per-sec", flags.actions / timing.wall);
+  PrintCol("allocations-per-action", 1. * total_allocations.load() / flags.actions);
+  PrintCol("drains-per-action", 1. * drains / flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// Busy-waits for `d`.
+void Spin(std::chrono::nanoseconds d) {
+  auto end = std::chrono::steady_clock::now() + d;
+  while (std::chrono::steady_clock::now() < end) {
+  }
+}
+
+class LingerChainSync {
+ public:
+  using Mem = ActionChain::Mem;
+
+  explicit LingerChainSync(const Flags& flags)
+      : chain_(ActionChain::Options{static_cast<std::uint32_t>(flags.linger)}) {}
+
+  template <class F>
+  void Run(Mem* mem, F&& f) {
+    chain_.Run(mem, std::forward<F>(f));
+  }
+
+ private:
+  ActionChain chain_;
+};
+
+class BurstyCriticalSectionSync : public CriticalSection {
+ public:
+  explicit BurstyCriticalSectionSync(const Flags&) {}
+};
+
+template <class Sync>
+int BurstyBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+  CHECK(flags.burst > 0);
+
+  PrintHeader(flags);
+  PrintCol("linger", flags.linger);
+  PrintCol("burst", flags.burst);
+  PrintCol("gap-ns", flags.gap_ns);
+  std::cout << std::flush;
+
+  struct {
+    volatile std::uint64_t counter = 0;
+    // The number of actions that ran on a different thread than the previous action.
+    // Every such switch moves the guarded state to another core.
+    std::uint64_t migrations = 0;
+    std::uint64_t last_thread = 0;
+  } state;
+
+  Timing timing = Measure([&] {
+    Sync sync(flags);
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        thread_index = t;
+        typename Sync::Mem mem;
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          if (i && i % flags.burst == 0) Spin(std::chrono::nanoseconds(flags.gap_ns));
+          sync.Run(&mem, [&] {
+            state.migrations += std::exchange(state.last_thread, thread_index) != thread_index;
+            for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++state.counter;
+          });
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  if (state.counter != flags.ops_per_action * flags.actions) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("actions-per-sec", flags.actions / timing.wall);
+  PrintCol("migrations-per-action", 1. * state.migrations / flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+class FairChainSync {
+ public:
+  explicit FairChainSync(const Flags& flags)
+      : chain_(std::vector<std::uint32_t>(flags.threads, 1)) {}
+
+  template <class F>
+  void Run(std::size_t tenant, F&& f) {
+    chain_.Run(tenant, std::forward<F>(f));
+  }
+
+ private:
+  FairActionChain chain_;
+};
+
+class FifoChainSync {
+ public:
+  explicit FifoChainSync(const Flags&) {}
+
+  template <class F>
+  void Run(std::size_t, F&& f) {
+    chain_.Run(std::forward<F>(f));
+  }
+
+ private:
+  ActionChain chain_;
+};
+
+template <class Sync>
+int FairBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+  CHECK(flags.threads >= 2);
+
+  PrintHeader(flags);
+  PrintCol("gap-ns", flags.gap_ns);
+  std::cout << std::flush;
+
+  volatile std::uint64_t counter = 0;
+  // Latency of actions of every tenant. Guarded by the primitive.
+  std::vector<std::vector<std::uint64_t>> latency(flags.threads);
+  for (auto& v : latency) v.reserve(actions_per_thread);
+
+  Timing timing = Measure([&] {
+    Sync sync(flags);
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          // Tenant 0 is noisy and never pauses.
+          if (t) Spin(std::chrono::nanoseconds(flags.gap_ns));
+          auto start = std::chrono::steady_clock::now();
+          sync.Run(t, [&, t, start] {
+            latency[t].push_back(std::chrono::nanoseconds(std::chrono::steady_clock::now() - start)
+                                     .count());
+            for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++counter;
+          });
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  if (counter != flags.ops_per_action * flags.actions) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  std::vector<std::uint64_t> quiet;
+  for (std::uint64_t t = 1; t != flags.threads; ++t) {
+    quiet.insert(quiet.end(), latency[t].begin(), latency[t].end());
+  }
+  PrintTiming(timing, flags.actions);
+  PrintLatency("noisy-latency", latency[0]);
+  PrintLatency("quiet-latency", quiet);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+class PowerOfTwoPoolSync {
+ public:
+  explicit PowerOfTwoPoolSync(const Flags& flags) : pool_(flags.chains) {}
+
+  template <class F>
+  void Run(F&& f) {
+    pool_.RunAnywhere(std::forward<F>(f));
+  }
+
+ private:
+  ChainPool pool_;
+};
+
+class RoundRobinPoolSync {
+ public:
+  explicit RoundRobinPoolSync(const Flags& flags) : pool_(flags.chains) {}
+
+  template <class F>
+  void Run(F&& f) {
+    static thread_local std::uint64_t n = 0;
+    pool_.Run((thread_index + n++) % pool_.num_chains(), std::forward<F>(f));
+  }
+
+ private:
+  ChainPool pool_;
+};
+
+class SingleChainPoolSync {
+ public:
+  explicit SingleChainPoolSync(const Flags&) {}
+
+  template <class F>
+  void Run(F&& f) {
+    chain_.Run([f = std::forward<F>(f)]() mutable { std::move(f)(0); });
+  }
+
+ private:
+  ActionChain chain_;
+};
+
+template <class Sync>
+int PoolBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+
+  PrintHeader(flags);
+  PrintCol("chains", flags.chains);
+  std::cout << std::flush;
+
+  struct alignas(64) Shard {
+    volatile std::uint64_t counter = 0;
+    std::uint64_t actions = 0;
+  };
+  std::unique_ptr<Shard[]> shards(new Shard[flags.chains]);
+
+  Timing timing = Measure([&] {
+    Sync sync(flags);
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        thread_index = t;
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          sync.Run([&](std::size_t c) {
+            ++shards[c].actions;
+            for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++shards[c].counter;
+          });
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  std::uint64_t counter = 0;
+  std::uint64_t max_actions = 0;
+  for (std::size_t i = 0; i != flags.chains; ++i) {
+    counter += shards[i].counter;
+    max_actions = std::max(max_actions, shards[i].actions);
+  }
+  if (counter != flags.ops_per_action * flags.actions) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("actions-per-sec", flags.actions / timing.wall);
+  // Relative to --chains even for syncs that use fewer chains.
+  PrintCol("imbalance", 1. * max_actions * flags.chains / flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// Object read in reclaim scenario. Readers check that it's intact.
+struct Version {
+  explicit Version(std::uint64_t v) : a(v), b(v) { live.fetch_add(1, std::memory_order_relaxed); }
+  ~Version() {
+    a = b + 1;
+    live.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  std::uint64_t a;
+  std::uint64_t b;
+
+  // The number of existing instances.
+  static inline std::atomic<std::int64_t> live{0};
+};
+
+class ReclaimerSync {
+ public:
+  class Reader {
+   public:
+    explicit Reader(ReclaimerSync* sync) : sync_(sync), reader_(&sync->reclaimer_) {}
+
+    bool Read() {
+      const Version* v = sync_->cur_.load(std::memory_order_acquire);
+      bool ok = v->a == v->b;
+      reader_.Quiesce();
+      return ok;
+    }
+
+    void Write(std::uint64_t x) {
+      sync_->chain_.Run(&mem_, [s = sync_, x] {
+        s->reclaimer_.Retire(s->cur_.exchange(new Version(x), std::memory_order_acq_rel));
+      });
+    }
+
+   private:
+    ReclaimerSync* sync_;
+    Reclaimer::Reader reader_;
+    ActionChain::Mem mem_;
+  };
+
+  ~ReclaimerSync() { delete cur_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<const Version*> cur_{new Version(0)};
+  ActionChain chain_;
+  Reclaimer reclaimer_{&chain_};
+};
+
+class SharedPtrSync {
+ public:
+  class Reader {
+   public:
+    explicit Reader(SharedPtrSync* sync) : sync_(sync) {}
+
+    bool Read() {
+      std::shared_ptr<const Version> v = std::atomic_load(&sync_->cur_);
+      return v->a == v->b;
+    }
+
+    void Write(std::uint64_t x) {
+      sync_->chain_.Run(&mem_, [s = sync_, x] {
+        std::atomic_store(&s->cur_, std::shared_ptr<const Version>(new Version(x)));
+      });
+    }
+
+   private:
+    SharedPtrSync* sync_;
+    ActionChain::Mem mem_;
+  };
+
+ private:
+  std::shared_ptr<const Version> cur_{new Version(0)};
+  ActionChain chain_;
+};
+
+template <class Sync>
+int ReclaimBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+  CHECK(flags.write_rate <= 100);
+
+  PrintHeader(flags);
+  PrintCol("write-rate", flags.write_rate);
+  std::cout << std::flush;
+
+  std::atomic<std::uint64_t> failed{0};
+  Timing timing = Measure([&] {
+    Sync sync;
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        typename Sync::Reader reader(&sync);
+        Rng rng(t + 1);
+        std::uint64_t f = 0;
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          if (rng.Uniform(100) < flags.write_rate) {
+            reader.Write(i);
+          } else {
+            f += !reader.Read();
+          }
+        }
+        failed.fetch_add(f, std::memory_order_relaxed);
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  if (failed.load() || Version::live.load() != 0) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("actions-per-sec", flags.actions / timing.wall);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+class RateLimitedSync {
+ public:
+  using Mem = ActionChain::Mem;
+
+  explicit RateLimitedSync(const Flags& flags) : chain_(flags.rate, flags.burst) {}
+
+  template <class F>
+  void Run(Mem* mem, F&& f) {
+    chain_.Run(mem, std::forward<F>(f));
+  }
+
+ private:
+  RateLimitedActionChain chain_;
+};
+
+// Enforces the same limit as RateLimitedActionChain by sleeping in the action until the
+// next token is available. Producers that happen to drain sleep too.
+class SleepInActionSync {
+ public:
+  using Mem = ActionChain::Mem;
+
+  explicit SleepInActionSync(const Flags& flags)
+      : period_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(1. / flags.rate))),
+        burst_window_(period_ * static_cast<std::int64_t>(flags.burst - 1)) {}
+
+  template <class F>
+  void Run(Mem* mem, F&& f) {
+    chain_.Run(mem, [this, f = std::forward<F>(f)]() mutable {
+      auto now = std::chrono::steady_clock::now();
+      if (full_at_ > now + burst_window_) {
+        now = full_at_ - burst_window_;
+        std::this_thread::sleep_until(now);
+      }
+      full_at_ = std::max(full_at_, now) + period_;
+      f();
+    });
+  }
+
+ private:
+  const std::chrono::nanoseconds period_;
+  const std::chrono::nanoseconds burst_window_;
+  // Guarded by chain_.
+  std::chrono::steady_clock::time_point full_at_;
+  ActionChain chain_;
+};
+
+template <class Sync>
+int RateLimitBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+  CHECK(flags.rate > 0);
+  CHECK(flags.burst > 0 && flags.burst < flags.actions);
+
+  PrintHeader(flags);
+  PrintCol("rate", flags.rate);
+  PrintCol("burst", flags.burst);
+  std::cout << std::flush;
+
+  // Guarded by the primitive.
+  struct {
+    volatile std::uint64_t counter = 0;
+    std::chrono::steady_clock::time_point first;
+    std::chrono::steady_clock::time_point last;
+  } state;
+  std::atomic<std::uint64_t> done{0};
+  // Time spent in Run() by every thread.
+  std::vector<std::vector<std::uint64_t>> latency(flags.threads);
+
+  Timing timing = Measure([&] {
+    Sync sync(flags);
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        typename Sync::Mem mem;
+        latency[t].reserve(actions_per_thread);
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          auto start = std::chrono::steady_clock::now();
+          sync.Run(&mem, [&] {
+            auto now = std::chrono::steady_clock::now();
+            if (state.counter == 0) state.first = now;
+            state.last = now;
+            for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) ++state.counter;
+            done.fetch_add(1, std::memory_order_release);
+          });
+          latency[t].push_back(
+              std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count());
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+    // Actions may still be waiting for tokens.
+    while (done.load(std::memory_order_acquire) != flags.actions) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+
+  // The first `burst` actions run back to back; the rest are paced.
+  double paced_sec = std::chrono::duration<double>(state.last - state.first).count();
+  double achieved = (flags.actions - flags.burst) / paced_sec;
+  // The period is rounded down to whole nanoseconds, so the limit can be exceeded by a hair.
+  if (state.counter != flags.ops_per_action * flags.actions || achieved > 1.01 * flags.rate) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  std::vector<std::uint64_t> all;
+  for (const auto& v : latency) all.insert(all.end(), v.begin(), v.end());
+  PrintTiming(timing, flags.actions);
+  PrintCol("actions-per-sec", achieved);
+  PrintCol("rate-error(%)", 100 * (achieved / flags.rate - 1));
+  PrintLatency("run-latency", std::move(all));
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// State of all state machines in state-machine scenario.
+template <class Sync>
+struct Machines {
+  Sync sync;
+  std::uint64_t ops_per_action;
+  volatile std::uint64_t counter = 0;
+};
+
+// One step of a state machine. Schedules the next step when it's done.
+template <class Sync>
+struct MachineStep {
+  void operator()() const {
+    for (std::uint64_t j = 0; j != m->ops_per_action; ++j) ++m->counter;
+    if (steps_left > 1) m->sync.Next(MachineStep{m, steps_left - 1});
+  }
+
+  Machines<Sync>* m;
+  std::uint64_t steps_left;
+};
+
+class RunMachineSync {
+ public:
+  using Mem = ActionChain::Mem;
+
+  template <class F>
+  void Start(Mem* mem, F&& f) {
+    chain_.Run(mem, std::forward<F>(f));
+  }
+
+  template <class F>
+  void Next(F&& f) {
+    chain_.Run(std::forward<F>(f));
+  }
+
+ private:
+  ActionChain chain_;
+};
+
+class RunNextMachineSync {
+ public:
+  using Mem = ActionChain::Mem;
+
+  template <class F>
+  void Start(Mem* mem, F&& f) {
+    chain_.Run(mem, std::forward<F>(f));
+  }
+
+  template <class F>
+  void Next(F&& f) {
+    chain_.RunNext(std::forward<F>(f));
+  }
+
+ private:
+  ActionChain chain_;
+};
+
+// Parks every request with RunWhen() together with a second waiter that closes the gate
+// behind it, and then opens the gate. Both waiters become ready at once, so steps that
+// the first one schedules with RunNext() must run before the second one.
+class RunWhenMachineSync {
+ public:
+  using Mem = ActionChain::Mem;
+
+  template <class F>
+  void Start(Mem* mem, F&& f) {
+    auto open = [this] { return open_; };
+    chain_.RunWhen(mem, &gate_, open, std::forward<F>(f));
+    chain_.RunWhen(mem, &gate_, open, [this] {
+      misordered_ += pending_ != 0;
+      open_ = false;
+    });
+    chain_.Run(mem, [this] {
+      open_ = true;
+      chain_.Notify(&gate_);
+    });
+  }
+
+  // Reaches the sync through `step` so that the continuation fits into a node.
+  void Next(MachineStep<RunWhenMachineSync> step) {
+    ++pending_;
+    chain_.RunNext([step] {
+      --step.m->sync.pending_;
+      step();
+    });
+  }
+
+  // The number of times a parked action ran ahead of continuations of the previous one.
+  std::uint64_t misordered() const { return misordered_; }
+
+ private:
+  ActionChain chain_;
+  ActionChain::Condition gate_;
+  // Guarded by chain_.
+  bool open_ = false;
+  std::uint64_t pending_ = 0;
+  std::uint64_t misordered_ = 0;
+};
+
+template <class Sync>
+std::uint64_t Misordered(const Sync&) {
+  return 0;
+}
+
+std::uint64_t Misordered(const RunWhenMachineSync& sync) { return sync.misordered(); }
+
+// Acquires the mutex once per step. Next() is called under the lock and merely
+// records the step, which Start() runs after releasing the lock.
+class CriticalSectionMachineSync {
+ public:
+  using Mem = int;
+
+  template <class F>
+  void Start(Mem*, F f) {
+    std::optional<F> next = std::move(f);
+    while (next) {
+      std::lock_guard lock(mutex_);
+      F step = std::move(*next);
+      next.reset();
+      next_ = &next;
+      step();
+    }
+  }
+
+  template <class F>
+  void Next(F&& f) {
+    static_cast<std::optional<std::decay_t<F>>*>(next_)->emplace(std::forward<F>(f));
+  }
+
+ private:
+  std::mutex mutex_;
+  void* next_;
+};
+
+template <class Sync>
+int StateMachineBenchmark(const Flags& flags) {
+  const std::uint64_t requests_per_thread = flags.actions / flags.threads;
+  CHECK(requests_per_thread * flags.threads == flags.actions);
+  CHECK(flags.steps > 0);
+
+  PrintHeader(flags);
+  PrintCol("steps", flags.steps);
+  std::cout << std::flush;
+
+  auto m = std::make_unique<Machines<Sync>>();
+  m->ops_per_action = flags.ops_per_action;
+  Timing timing = Measure([&] {
+    std::vector<std::thread> threads;
+    for (std::uint64_t i = 0; i != flags.threads; ++i) {
+      threads.emplace_back([&] {
+        typename Sync::Mem mem;
+        for (std::uint64_t i = 0; i != requests_per_thread; ++i) {
+          m->sync.Start(&mem, MachineStep<Sync>{m.get(), flags.steps});
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  if (m->counter != flags.ops_per_action * flags.steps * flags.actions ||
+      Misordered(m->sync)) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions * flags.steps);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// Frame address of the benchmark thread's main function.
+thread_local const char* stack_top = nullptr;
+// The maximum stack depth of actions executed by the current thread.
+thread_local std::uint64_t thread_max_stack_depth = 0;
+// The maximum stack depth of actions executed by all threads.
+std::atomic<std::uint64_t> max_stack_depth{0};
+
+__attribute__((noinline)) void RecordStackDepth() {
+  std::uint64_t depth = stack_top - static_cast<const char*>(__builtin_frame_address(0));
+  if (depth <= thread_max_stack_depth) return;
+  thread_max_stack_depth = depth;
+  std::uint64_t max = max_stack_depth.load(std::memory_order_relaxed);
+  while (max < depth && !max_stack_depth.compare_exchange_weak(max, depth)) {
+  }
+}
+
+template <class Sync>
+struct Pipeline {
+  struct alignas(64) Stage {
+    Sync sync;
+    volatile std::uint64_t counter = 0;
+    std::uint64_t items = 0;
+    // When the stage processed its last item, measured from `start`.
+    std::uint64_t done_ns = 0;
+  };
+
+  explicit Pipeline(const Flags& flags)
+      : stages(new Stage[flags.stages]),
+        num_stages(flags.stages),
+        num_items(flags.actions),
+        ops_per_action(flags.ops_per_action) {
+    latency.reserve(flags.actions);
+  }
+
+  std::uint64_t Now() const {
+    return std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count();
+  }
+
+  std::unique_ptr<Stage[]> stages;
+  std::uint64_t num_stages;
+  std::uint64_t num_items;
+  std::uint64_t ops_per_action;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  // End-to-end latency of every item. Written by the last stage.
+  std::vector<std::uint64_t> latency;
+  // The number of items that have passed all stages.
+  std::atomic<std::uint64_t> done{0};
+};
+
+// Processes an item on one stage of a pipeline and passes it to the next stage.
+template <class Sync>
+struct PipelineStep {
+  static constexpr int kStageShift = 56;
+
+  void operator()() const {
+    RecordStackDepth();
+    std::uint64_t i = stage_and_start >> kStageShift;
+    std::uint64_t start = stage_and_start & ((std::uint64_t{1} << kStageShift) - 1);
+    auto& stage = p->stages[i];
+    for (std::uint64_t j = 0; j != p->ops_per_action; ++j) ++stage.counter;
+    if (++stage.items == p->num_items) stage.done_ns = p->Now();
+    if (i + 1 != p->num_stages) {
+      p->stages[i + 1].sync.Run(PipelineStep{p, stage_and_start + (1ull << kStageShift)});
+    } else {
+      p->latency.push_back(p->Now() - start);
+      p->done.store(p->latency.size(), std::memory_order_release);
+    }
+  }
+
+  Pipeline<Sync>* p;
+  // Stage index in the top 8 bits; the time when the item entered the pipeline,
+  // measured from Pipeline::start, in the rest. Packed to fit into ActionChain nodes.
+  std::uint64_t stage_and_start;
+};
+
+class PipelineChainSync {
+ public:
+  // Set up on every benchmark thread.
+  struct ThreadScope {
+    ThreadScope() {}
+  };
+
+  template <class F>
+  void Run(F&& f) {
+    chain_.Run(std::forward<F>(f));
+  }
+
+ private:
+  ActionChain chain_;
+};
+
+class PipelineTrampolineSync : public PipelineChainSync {
+ public:
+  using ThreadScope = ActionChain::Trampoline;
+};
+
+class PipelineCriticalSectionSync {
+ public:
+  struct ThreadScope {
+    ThreadScope() {}
+  };
+
+  template <class F>
+  void Run(F&& f) {
+    std::lock_guard lock(mutex_);
+    std::move(f)();
+  }
+
+ private:
+  std::mutex mutex_;
+};
+
+// Every stage has a dedicated thread that runs actions from a queue guarded by
+// a mutex.
+class PipelineQueueSync {
+ public:
+  struct ThreadScope {
+    ThreadScope() {}
+  };
+
+  PipelineQueueSync() : worker_([this] { Loop(); }) {}
+
+  ~PipelineQueueSync() {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+  }
+
+  template <class F>
+  void Run(F&& f) {
+    // Notify under the lock: once the item is in the queue, the last stage may finish
+    // and the benchmark may destroy this object.
+    std::lock_guard lock(mutex_);
+    queue_.emplace_back(std::forward<F>(f));
+    cv_.notify_one();
+  }
+
+ private:
+  void Loop() {
+    stack_top = static_cast<const char*>(__builtin_frame_address(0));
+    std::unique_lock lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [&] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) break;
+      std::function<void()> f = std::move(queue_.front());
+      queue_.pop_front();
+      lock.unlock();
+      f();
+      lock.lock();
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> queue_;
+  bool stop_ = false;
+  std::thread worker_;
+};
+
+template <class Sync>
+int PipelineBenchmark(const Flags& flags) {
+  const std::uint64_t items_per_thread = flags.actions / flags.threads;
+  CHECK(items_per_thread * flags.threads == flags.actions);
+  CHECK(flags.stages > 0 && flags.stages < 256);
+
+  PrintHeader(flags);
+  PrintCol("stages", flags.stages);
+  std::cout << std::flush;
+
+  Pipeline<Sync> p(flags);
+  Timing timing = Measure([&] {
+    std::vector<std::thread> threads;
+    for (std::uint64_t i = 0; i != flags.threads; ++i) {
+      threads.emplace_back([&] {
+        stack_top = static_cast<const char*>(__builtin_frame_address(0));
+        typename Sync::ThreadScope scope;
+        for (std::uint64_t i = 0; i != items_per_thread; ++i) {
+          p.stages[0].sync.Run(PipelineStep<Sync>{&p, p.Now()});
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+    while (p.done.load(std::memory_order_acquire) != flags.actions) std::this_thread::yield();
+  });
+
+  for (std::uint64_t i = 0; i != flags.stages; ++i) {
+    if (p.stages[i].counter != flags.ops_per_action * flags.actions) {
+      std::cerr << "TEST FAILURE" << std::endl;
+      return 1;
+    }
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintLatency("latency", std::move(p.latency));
+  for (std::uint64_t i = 0; i != flags.stages; ++i) {
+    std::string col = "stage-" + std::to_string(i) + "-items-per-sec";
+    PrintCol(col.c_str(), 1e9 * flags.actions / p.stages[i].done_ns);
+  }
+  PrintCol("max-stack-depth(B)", max_stack_depth.load());
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// Like OrderedPipeline but every serial stage reorders items in a priority queue
+// guarded by a mutex and processes them under the same mutex.
+template <class T>
+class MutexOrderedPipeline {
+ public:
+  using StageFn = std::function<void(T&)>;
+
+  explicit MutexOrderedPipeline(ThreadPool* pool) : pool_(pool) {}
+  MutexOrderedPipeline(MutexOrderedPipeline&&) = delete;
+  ~MutexOrderedPipeline() { Wait(); }
+
+  void AddParallelStage(StageFn f) { stages_.emplace_back(new Stage{false, std::move(f)}); }
+  void AddSerialStage(StageFn f) { stages_.emplace_back(new Stage{true, std::move(f)}); }
+
+  void Submit(T value) {
+    {
+      std::lock_guard lock(mutex_);
+      ++pending_;
+    }
+    Process(new Item{next_seq_++, 0, std::move(value)});
+  }
+
+  void Wait() {
+    std::unique_lock lock(mutex_);
+    idle_.wait(lock, [&] { return pending_ == 0; });
+  }
+
+ private:
+  struct Item {
+    std::uint64_t seq;
+    std::size_t stage;
+    T value;
+  };
+
+  struct LaterSeq {
+    bool operator()(const Item* x, const Item* y) const { return x->seq > y->seq; }
+  };
+
+  struct Stage {
+    bool serial;
+    StageFn f;
+    std::mutex mutex;
+    std::priority_queue<Item*, std::vector<Item*>, LaterSeq> reorder;
+    std::uint64_t next_seq = 0;
+  };
+
+  void Process(Item* item) {
+    if (item->stage == stages_.size()) {
+      delete item;
+      std::lock_guard lock(mutex_);
+      if (--pending_ == 0) idle_.notify_all();
+      return;
+    }
+    Stage* stage = stages_[item->stage].get();
+    if (!stage->serial) {
+      pool_->Schedule([this, item] {
+        stages_[item->stage++]->f(item->value);
+        Process(item);
+      });
+      return;
+    }
+    std::vector<Item*> ready;
+    {
+      std::lock_guard lock(stage->mutex);
+      stage->reorder.push(item);
+      while (!stage->reorder.empty() && stage->reorder.top()->seq == stage->next_seq) {
+        item = stage->reorder.top();
+        stage->reorder.pop();
+        ++stage->next_seq;
+        stage->f(item->value);
+        ++item->stage;
+        ready.push_back(item);
+      }
+    }
+    for (Item* x : ready) Process(x);
+  }
+
+  ThreadPool* const pool_;
+  std::vector<std::unique_ptr<Stage>> stages_;
+  std::uint64_t next_seq_ = 0;
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  std::uint64_t pending_ = 0;
+};
+
+template <template <class> class Pipeline>
+int OrderedPipelineBenchmark(const Flags& flags) {
+  CHECK(flags.threads == 1);
+  CHECK(flags.stages > 0);
+  CHECK(flags.parallelism > 0);
+
+  PrintHeader(flags);
+  PrintCol("stages", flags.stages);
+  PrintCol("parallelism", flags.parallelism);
+  std::cout << std::flush;
+
+  struct Item {
+    std::uint64_t index;
+    std::uint64_t hash;
+  };
+
+  // For every serial stage: the number of items it has processed and the number of
+  // those that arrived out of order.
+  std::vector<std::uint64_t> processed(flags.stages);
+  std::vector<std::uint64_t> misordered(flags.stages);
+
+  Timing timing = Measure([&] {
+    ThreadPool pool(flags.parallelism);
+    Pipeline<Item> pipeline(&pool);
+    for (std::uint64_t i = 0; i != flags.stages; ++i) {
+      if (i % 2 == 0) {
+        pipeline.AddParallelStage([&](Item& x) {
+          for (std::uint64_t j = 0; j != flags.ops_per_action; ++j) {
+            x.hash = x.hash * 0x9E3779B97F4A7C15 + j;
+          }
+        });
+      } else {
+        pipeline.AddSerialStage([&, i](Item& x) {
+          misordered[i] += x.index != processed[i]++;
+        });
+      }
+    }
+    for (std::uint64_t i = 0; i != flags.actions; ++i) pipeline.Submit(Item{i, i});
+    pipeline.Wait();
+  });
+
+  for (std::uint64_t i = 1; i < flags.stages; i += 2) {
+    if (processed[i] != flags.actions || misordered[i]) {
+      std::cerr << "TEST FAILURE" << std::endl;
+      return 1;
+    }
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("items-per-sec", flags.actions / timing.wall);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// Lock-based equivalent of DelegatedHashMap. Callbacks run under the lock.
+template <class K, class V>
+class LockedHashMap {
+ public:
+  explicit LockedHashMap(std::size_t num_shards)
+      : shards_(new Shard[num_shards]), n_(num_shards) {}
+
+  void Insert(K key, V value) {
+    Shard* s = ShardOf(key);
+    std::lock_guard lock(s->mutex);
+    s->map.insert_or_assign(std::move(key), std::move(value));
+  }
+
+  template <class Done>
+  void Find(const K& key, Done&& done) {
+    Shard* s = ShardOf(key);
+    std::lock_guard lock(s->mutex);
+    auto it = s->map.find(key);
+    std::forward<Done>(done)(it == s->map.end() ? nullptr : &it->second);
+  }
+
+  template <class Done>
+  void FindMany(const std::vector<K>& keys, Done&& done) {
+    std::vector<std::optional<V>> values(keys.size());
+    for (std::size_t i = 0; i != keys.size(); ++i) {
+      Shard* s = ShardOf(keys[i]);
+      std::lock_guard lock(s->mutex);
+      auto it = s->map.find(keys[i]);
+      if (it != s->map.end()) values[i] = it->second;
+    }
+    std::forward<Done>(done)(std::move(values));
+  }
+
+ private:
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    std::unordered_map<K, V> map;
+  };
+
+  Shard* ShardOf(const K& key) { return &shards_[std::hash<K>()(key) % n_]; }
+
+  std::unique_ptr<Shard[]> shards_;
+  std::size_t n_;
+};
+
+// Lock-based equivalent of DelegatedPriorityQueue.
+template <class T>
+class LockedPriorityQueue {
+ public:
+  void Push(T value) {
+    std::lock_guard lock(mutex_);
+    queue_.push(std::move(value));
+  }
+
+  template <class Done>
+  void Pop(Done&& done) {
+    std::lock_guard lock(mutex_);
+    std::optional<T> res;
+    if (!queue_.empty()) {
+      res = queue_.top();
+      queue_.pop();
+    }
+    std::forward<Done>(done)(std::move(res));
+  }
+
+  template <class Done>
+  void PopMany(std::size_t n, Done&& done) {
+    std::lock_guard lock(mutex_);
+    std::vector<T> res;
+    while (res.size() != n && !queue_.empty()) {
+      res.push_back(queue_.top());
+      queue_.pop();
+    }
+    std::forward<Done>(done)(std::move(res));
+  }
+
+ private:
+  std::mutex mutex_;
+  std::priority_queue<T> queue_;
+};
+
+// Lock-based equivalent of DelegatedBoundedDeque.
+template <class T>
+class LockedBoundedDeque {
+ public:
+  explicit LockedBoundedDeque(std::size_t capacity) : capacity_(capacity) {}
+
+  template <class Done>
+  void PushBack(T value, Done&& done) {
+    std::lock_guard lock(mutex_);
+    bool ok = deque_.size() != capacity_;
+    if (ok) deque_.push_back(std::move(value));
+    std::forward<Done>(done)(ok);
+  }
+
+  template <class Done>
+  void PushFront(T value, Done&& done) {
+    std::lock_guard lock(mutex_);
+    bool ok = deque_.size() != capacity_;
+    if (ok) deque_.push_front(std::move(value));
+    std::forward<Done>(done)(ok);
+  }
+
+  template <class Done>
+  void PopBack(Done&& done) {
+    std::lock_guard lock(mutex_);
+    std::optional<T> res;
+    if (!deque_.empty()) {
+      res = std::move(deque_.back());
+      deque_.pop_back();
+    }
+    std::forward<Done>(done)(std::move(res));
+  }
+
+  template <class Done>
+  void PopFront(Done&& done) {
+    std::lock_guard lock(mutex_);
+    std::optional<T> res;
+    if (!deque_.empty()) {
+      res = std::move(deque_.front());
+      deque_.pop_front();
+    }
+    std::forward<Done>(done)(std::move(res));
+  }
+
+  template <class Done>
+  void Size(Done&& done) {
+    std::lock_guard lock(mutex_);
+    std::forward<Done>(done)(deque_.size());
+  }
+
+ private:
+  const std::size_t capacity_;
+  std::mutex mutex_;
+  std::deque<T> deque_;
+};
+
+// Counters updated by callbacks of containers in hash-map, priority-queue and deque
+// scenarios. Callbacks of delegated containers may run on any thread.
+struct alignas(64) Tally {
+  std::atomic<std::uint64_t> ok{0};
+  std::atomic<std::uint64_t> failed{0};
+};
+
+template <class Map>
+int HashMapBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+  CHECK(flags.keys > 0 && flags.parallelism > 0 && flags.batch > 0);
+
+  PrintHeader(flags);
+  PrintCol("keys", flags.keys);
+  PrintCol("shards", flags.parallelism);
+  PrintCol("batch", flags.batch);
+  std::cout << std::flush;
+
+  // Every key maps to itself. `ok` counts lookups, `failed` counts wrong values.
+  std::unique_ptr<Tally[]> tally(new Tally[flags.threads]);
+  std::vector<std::uint64_t> lookups(flags.threads);
+
+  Map map(flags.parallelism);
+  Timing timing = Measure([&] {
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        Rng rng(t + 1);
+        Tally* tl = &tally[t];
+        std::vector<std::uint64_t> keys;
+        auto Flush = [&] {
+          lookups[t] += keys.size();
+          map.FindMany(keys, [tl, keys](std::vector<std::optional<std::uint64_t>> values) {
+            tl->ok.fetch_add(keys.size(), std::memory_order_relaxed);
+            for (std::size_t i = 0; i != keys.size(); ++i) {
+              if (values[i] && *values[i] != keys[i]) {
+                tl->failed.fetch_add(1, std::memory_order_relaxed);
+              }
+            }
+          });
+          keys.clear();
+        };
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          std::uint64_t key = rng.Uniform(flags.keys);
+          if (rng.Next() & 1) {
+            map.Insert(key, key);
+          } else if (flags.batch == 1) {
+            ++lookups[t];
+            map.Find(key, [tl, key](const std::uint64_t* val) {
+              tl->ok.fetch_add(1, std::memory_order_relaxed);
+              if (val && *val != key) tl->failed.fetch_add(1, std::memory_order_relaxed);
+            });
+          } else {
+            keys.push_back(key);
+            if (keys.size() == flags.batch) Flush();
+          }
+        }
+        if (!keys.empty()) Flush();
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  for (std::uint64_t t = 0; t != flags.threads; ++t) {
+    if (tally[t].ok != lookups[t] || tally[t].failed) {
+      std::cerr << "TEST FAILURE" << std::endl;
+      return 1;
+    }
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("actions-per-sec", flags.actions / timing.wall);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+template <class Queue>
+int PriorityQueueBenchmark(const Flags& flags) {
+  CHECK(flags.batch > 0);
+  const std::uint64_t rounds_per_thread = flags.actions / flags.threads / (2 * flags.batch);
+  CHECK(rounds_per_thread * flags.threads * 2 * flags.batch == flags.actions);
+
+  PrintHeader(flags);
+  PrintCol("batch", flags.batch);
+  std::cout << std::flush;
+
+  // Every thread pops after pushing, so pops never find the queue empty. `ok` counts
+  // popped elements, `failed` counts empty pops and misordered batches.
+  std::unique_ptr<Tally[]> tally(new Tally[flags.threads]);
+
+  Queue queue;
+  Timing timing = Measure([&] {
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        Rng rng(t + 1);
+        Tally* tl = &tally[t];
+        for (std::uint64_t i = 0; i != rounds_per_thread; ++i) {
+          for (std::uint64_t j = 0; j != flags.batch; ++j) queue.Push(rng.Next());
+          if (flags.batch == 1) {
+            queue.Pop([tl](std::optional<std::uint64_t> x) {
+              (x ? tl->ok : tl->failed).fetch_add(1, std::memory_order_relaxed);
+            });
+          } else {
+            queue.PopMany(flags.batch, [tl, n = flags.batch](std::vector<std::uint64_t> xs) {
+              tl->ok.fetch_add(xs.size(), std::memory_order_relaxed);
+              if (xs.size() != n || !std::is_sorted(xs.rbegin(), xs.rend())) {
+                tl->failed.fetch_add(1, std::memory_order_relaxed);
+              }
+            });
+          }
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  for (std::uint64_t t = 0; t != flags.threads; ++t) {
+    if (tally[t].ok != rounds_per_thread * flags.batch || tally[t].failed) {
+      std::cerr << "TEST FAILURE" << std::endl;
+      return 1;
+    }
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("actions-per-sec", flags.actions / timing.wall);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+template <class Deque>
+int DequeBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_thread = flags.actions / flags.threads;
+  CHECK(actions_per_thread * flags.threads == flags.actions);
+  CHECK(flags.capacity > 0);
+
+  PrintHeader(flags);
+  PrintCol("capacity", flags.capacity);
+  std::cout << std::flush;
+
+  // `ok` counts successful pushes, `failed` counts successful pops.
+  std::unique_ptr<Tally[]> tally(new Tally[flags.threads]);
+
+  Deque deque(flags.capacity);
+  Timing timing = Measure([&] {
+    std::vector<std::thread> threads;
+    for (std::uint64_t t = 0; t != flags.threads; ++t) {
+      threads.emplace_back([&, t] {
+        Rng rng(t + 1);
+        Tally* tl = &tally[t];
+        auto Pushed = [tl](bool ok) { tl->ok.fetch_add(ok, std::memory_order_relaxed); };
+        auto Popped = [tl](std::optional<std::uint64_t> x) {
+          tl->failed.fetch_add(x.has_value(), std::memory_order_relaxed);
+        };
+        for (std::uint64_t i = 0; i != actions_per_thread; ++i) {
+          switch (rng.Uniform(4)) {
+            case 0:
+              deque.PushBack(i, Pushed);
+              break;
+            case 1:
+              deque.PushFront(i, Pushed);
+              break;
+            case 2:
+              deque.PopBack(Popped);
+              break;
+            case 3:
+              deque.PopFront(Popped);
+              break;
+          }
+        }
+      });
+    }
+    for (std::thread& t : threads) t.join();
+  });
+
+  std::uint64_t pushed = 0;
+  std::uint64_t popped = 0;
+  for (std::uint64_t t = 0; t != flags.threads; ++t) {
+    pushed += tally[t].ok;
+    popped += tally[t].failed;
+  }
+  std::optional<std::size_t> size;
+  deque.Size([&](std::size_t n) { size = n; });
+  if (!size || *size > flags.capacity || pushed - popped != *size) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  PrintCol("actions-per-sec", flags.actions / timing.wall);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+// Shared memory mapped by all processes in cross-process scenario.
+class SharedRegion {
+ public:
+  explicit SharedRegion(std::size_t size) : size_(size) {
+    p_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    CHECK(p_ != MAP_FAILED);
+  }
+  SharedRegion(SharedRegion&&) = delete;
+  ~SharedRegion() { CHECK(munmap(p_, size_) == 0); }
+
+  void* get() const { return p_; }
+
+ private:
+  void* p_;
+  std::size_t size_;
+};
+
+class SharedChainSync {
+ public:
+  static std::size_t RegionSize(const Flags& flags) {
+    return SharedActionChain::RegionSize(flags.capacity, sizeof(std::uint64_t));
+  }
+
+  static void Init(void* region, const Flags& flags) {
+    SharedActionChain::Init(region, flags.capacity);
+  }
+
+  // Called in every process.
+  explicit SharedChainSync(void* region) : chain_(region) {
+    chain_.Register(kIncrement, [](void* data, const void* payload, std::size_t) {
+      volatile std::uint64_t* counter = static_cast<std::uint64_t*>(data);
+      std::uint64_t n = *static_cast<const std::uint64_t*>(payload);
+      for (std::uint64_t j = 0; j != n; ++j) ++*counter;
+    });
+  }
+
+  void Increment(std::uint64_t n) { chain_.Run(kIncrement, &n, sizeof(n)); }
+  std::uint64_t counter() const { return *static_cast<std::uint64_t*>(chain_.data()); }
+
+ private:
+  enum Opcode : std::uint32_t { kIncrement };
+
+  SharedActionChain chain_;
+};
+
+class ProcessSharedMutexSync {
+ public:
+  static std::size_t RegionSize(const Flags&) { return sizeof(Data); }
+
+  static void Init(void* region, const Flags&) {
+    Data* d = new (region) Data;
+    pthread_mutexattr_t attr;
+    CHECK(pthread_mutexattr_init(&attr) == 0);
+    CHECK(pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED) == 0);
+    CHECK(pthread_mutex_init(&d->mutex, &attr) == 0);
+    CHECK(pthread_mutexattr_destroy(&attr) == 0);
+  }
+
+  explicit ProcessSharedMutexSync(void* region) : data_(static_cast<Data*>(region)) {}
+
+  void Increment(std::uint64_t n) {
+    CHECK(pthread_mutex_lock(&data_->mutex) == 0);
+    for (std::uint64_t j = 0; j != n; ++j) ++data_->counter;
+    CHECK(pthread_mutex_unlock(&data_->mutex) == 0);
+  }
+
+  std::uint64_t counter() const { return data_->counter; }
+
+ private:
+  struct Data {
+    pthread_mutex_t mutex;
+    volatile std::uint64_t counter = 0;
+  };
+
+  Data* data_;
+};
+
+template <class Sync>
+int CrossProcessBenchmark(const Flags& flags) {
+  const std::uint64_t actions_per_process = flags.actions / flags.threads;
+  CHECK(actions_per_process * flags.threads == flags.actions);
+
+  PrintHeader(flags);
+  std::cout << std::flush;
+
+  SharedRegion region(Sync::RegionSize(flags));
+  Sync::Init(region.get(), flags);
+  Timing timing = Measure([&] {
+    std::vector<pid_t> children;
+    for (std::uint64_t i = 0; i != flags.threads; ++i) {
+      pid_t pid = fork();
+      CHECK(pid >= 0);
+      if (pid == 0) {
+        Sync sync(region.get());
+        for (std::uint64_t j = 0; j != actions_per_process; ++j) {
+          sync.Increment(flags.ops_per_action);
+        }
+        std::_Exit(0);
+      }
+      children.push_back(pid);
+    }
+    for (pid_t pid : children) {
+      int status;
+      CHECK(waitpid(pid, &status, 0) == pid);
+      CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+  });
+
+  if (Sync(region.get()).counter() != flags.ops_per_action * flags.actions) {
+    std::cerr << "TEST FAILURE" << std::endl;
+    return 1;
+  }
+
+  PrintTiming(timing, flags.actions);
+  std::cout << std::endl;
+
+  return 0;
+}
+
+int BenchmarkMain(int argc, char* argv[]) {
+  Flags flags = ParseFlags(argv + 1, argv + argc);
+  std::map<std::pair<std::string, std::string>, int (*)(const Flags&)> bm = {
+      {{"counter", "ActionChain"}, Benchmark<ActionChain>},
+      {{"counter", "ActionChainTLS"}, Benchmark<ActionChainTLS>},
+      {{"counter", "CriticalSection"}, Benchmark<CriticalSection>},
+      {{"counter", "Unsynchronized"}, Benchmark<Unsynchronized>},
+      {{"counter", "ActionChainFused"}, FusedBenchmark},
+      {{"thread-churn", "ActionChain"}, ThreadChurnBenchmark<ActionChain>},
+      {{"thread-churn", "ActionChainTLS"}, ThreadChurnBenchmark<ActionChainTLS>},
+      {{"thread-churn", "CriticalSection"}, ThreadChurnBenchmark<CriticalSection>},
+      {{"multi-chain", "ActionChain"}, MultiChainBenchmark<ActionChain>},
+      {{"multi-chain", "ActionChainTLS"}, MultiChainBenchmark<ActionChainTLS>},
+      {{"multi-chain", "CriticalSection"}, MultiChainBenchmark<CriticalSection>},
+      {{"pool", "PowerOfTwo"}, PoolBenchmark<PowerOfTwoPoolSync>},
+      {{"pool", "RoundRobin"}, PoolBenchmark<RoundRobinPoolSync>},
+      {{"pool", "ActionChain"}, PoolBenchmark<SingleChainPoolSync>},
+      {{"bounded-queue", "ActionChain"}, BoundedQueueBenchmark<ChainBoundedQueue>},
+      {{"bounded-queue", "CriticalSection"}, BoundedQueueBenchmark<CondVarBoundedQueue>},
+      {{"keyed", "KeyedActionChain"}, KeyedBenchmark<KeyedChainSync>},
+      {{"keyed", "ActionChain"}, KeyedBenchmark<SingleChainSync>},
+      {{"keyed", "ShardedActionChain"}, KeyedBenchmark<ShardedChainSync>},
+      {{"state-machine", "ActionChain"}, StateMachineBenchmark<RunMachineSync>},
+      {{"state-machine", "ActionChainRunNext"}, StateMachineBenchmark<RunNextMachineSync>},
+      {{"state-machine", "ActionChainRunWhen"}, StateMachineBenchmark<RunWhenMachineSync>},
+      {{"state-machine", "CriticalSection"}, StateMachineBenchmark<CriticalSectionMachineSync>},
+      {{"pipeline", "ActionChain"}, PipelineBenchmark<PipelineChainSync>},
+      {{"pipeline", "ActionChainTrampoline"}, PipelineBenchmark<PipelineTrampolineSync>},
+      {{"pipeline", "CriticalSection"}, PipelineBenchmark<PipelineCriticalSectionSync>},
+      {{"pipeline", "MutexQueue"}, PipelineBenchmark<PipelineQueueSync>},
+      {{"ordered-pipeline", "OrderedPipeline"}, OrderedPipelineBenchmark<OrderedPipeline>},
+      {{"ordered-pipeline", "MutexReorder"}, OrderedPipelineBenchmark<MutexOrderedPipeline>},
+      {{"hash-map", "Delegated"},
+       HashMapBenchmark<DelegatedHashMap<std::uint64_t, std::uint64_t>>},
+      {{"hash-map", "CriticalSection"},
+       HashMapBenchmark<LockedHashMap<std::uint64_t, std::uint64_t>>},
+      {{"priority-queue", "Delegated"},
+       PriorityQueueBenchmark<DelegatedPriorityQueue<std::uint64_t>>},
+      {{"priority-queue", "CriticalSection"},
+       PriorityQueueBenchmark<LockedPriorityQueue<std::uint64_t>>},
+      {{"deque", "Delegated"}, DequeBenchmark<DelegatedBoundedDeque<std::uint64_t>>},
+      {{"deque", "CriticalSection"}, DequeBenchmark<LockedBoundedDeque<std::uint64_t>>},
+      {{"many-types", "ActionChain"}, ManyTypesBenchmark<false>},
+      {{"many-types", "ActionChainRunCall"}, ManyTypesBenchmark<true>},
+      {{"heavy-capture", "ActionChain"}, HeavyCaptureBenchmark<false>},
+      {{"heavy-capture", "ActionChainEmplace"}, HeavyCaptureBenchmark<true>},
+      {{"overload", "ActionChain"}, OverloadBenchmark<false>},
+      {{"overload", "ActionChainDeadline"}, OverloadBenchmark<true>},
+      {{"accumulator", "ThreadLocalAccumulator"}, AccumulatorBenchmark<AccumulatorSync>},
+      {{"accumulator", "Atomic"}, AccumulatorBenchmark<AtomicAccumulatorSync>},
+      {{"accumulator", "ActionChain"}, AccumulatorBenchmark<ChainAccumulatorSync>},
+      {{"bursty", "ActionChain"}, BurstyBenchmark<LingerChainSync>},
+      {{"bursty", "CriticalSection"}, BurstyBenchmark<BurstyCriticalSectionSync>},
+      {{"fair", "FairActionChain"}, FairBenchmark<FairChainSync>},
+      {{"fair", "ActionChain"}, FairBenchmark<FifoChainSync>},
+      {{"reclaim", "Reclaimer"}, ReclaimBenchmark<ReclaimerSync>},
+      {{"reclaim", "SharedPtr"}, ReclaimBenchmark<SharedPtrSync>},
+      {{"rate-limit", "RateLimitedActionChain"}, RateLimitBenchmark<RateLimitedSync>},
+      {{"rate-limit", "SleepInAction"}, RateLimitBenchmark<SleepInActionSync>},
+      {{"cross-process", "SharedActionChain"}, CrossProcessBenchmark<SharedChainSync>},
+      {{"cross-process", "ProcessSharedMutex"}, CrossProcessBenchmark<ProcessSharedMutexSync>},
+  };
+  auto it = bm.find({flags.scenario, flags.sync});
+  CHECK(it != bm.end());
+#ifdef ROMKATV_ACTION_CHAIN_CENSUS
+  int res = it->second(flags);
+  if (flags.census) PrintCensus();
+  return res;
+#else
+  if (flags.census) {
+    std::cerr << "--census requires ActionChain::Census(): rebuild with `make clean && make "
+                 "CENSUS=1`"
+              << std::endl;
+    return 1;
+  }
+  return it->second(flags);
+#endif
 }
 
 }  // namespace
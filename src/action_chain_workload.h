@@ -0,0 +1,52 @@
+/* C ABI for custom workloads of action_chain_test.
+ *
+ * A workload is a shared library that exports the functions declared below. Load it
+ * with --workload=PATH and action_chain_test will run its actions through the
+ * synchronization primitive chosen with --sync, reporting the same timings as for the
+ * built-in workload.
+ *
+ * All functions except action_chain_workload_run are called from a single thread.
+ * Calls to action_chain_workload_run are serialized by the synchronization primitive
+ * (except Unsynchronized), but may happen on any benchmark thread.
+ *
+ * Example (examples/counter_workload.c):
+ *
+ *   static uint64_t counter;
+ *
+ *   void* action_chain_workload_init(uint64_t num_threads) { return &counter; }
+ *   void action_chain_workload_run(void* ctx, uint64_t thread_index) { ++counter; }
+ *   int action_chain_workload_verify(void* ctx, uint64_t num_actions) {
+ *     return counter == num_actions ? 0 : -1;
+ *   }
+ *   void action_chain_workload_teardown(void* ctx) {}
+ */
+
+#ifndef ROMKATV_ACTION_CHAIN_ACTION_CHAIN_WORKLOAD_H_
+#define ROMKATV_ACTION_CHAIN_ACTION_CHAIN_WORKLOAD_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Called once before the benchmark starts. The returned pointer is passed to all other
+ * functions. */
+void* action_chain_workload_init(uint64_t num_threads);
+
+/* Called once per action. `thread_index` is in [0, num_threads) and identifies the
+ * benchmark thread that has scheduled the action, which isn't necessarily the thread
+ * that runs it. */
+void action_chain_workload_run(void* ctx, uint64_t thread_index);
+
+/* Called once after all actions have completed. Returns zero on success. */
+int action_chain_workload_verify(void* ctx, uint64_t num_actions);
+
+/* Called once at the very end. */
+void action_chain_workload_teardown(void* ctx);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // ROMKATV_ACTION_CHAIN_ACTION_CHAIN_WORKLOAD_H_
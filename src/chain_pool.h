@@ -0,0 +1,97 @@
+#ifndef ROMKATV_ACTION_CHAIN_CHAIN_POOL_H_
+#define ROMKATV_ACTION_CHAIN_CHAIN_POOL_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "action_chain.h"
+
+namespace romkatv {
+
+// A fixed set of ActionChain instances for actions that need mutual exclusion with
+// whatever else runs on the same chain but don't care which chain that is, such as
+// actions that update per-chain shards of a counter.
+//
+// Every chain has a hint with the number of its pending actions. It's updated with
+// relaxed atomics and may be stale.
+//
+// Example:
+//
+//   struct alignas(64) Shard {
+//     uint64_t hits = 0;
+//   };
+//
+//   ChainPool pool(8);
+//   Shard shards[8];
+//
+//   void Hit() {
+//     pool.RunAnywhere([](std::size_t i) { ++shards[i].hits; });
+//   }
+class ChainPool {
+ public:
+  explicit ChainPool(std::size_t num_chains)
+      : slots_(new Slot[num_chains]), num_chains_(num_chains) {
+    assert(num_chains > 0);
+  }
+  ChainPool(ChainPool&&) = delete;
+
+  // Runs `action(std::size_t)` on one of two randomly picked chains, whichever has
+  // fewer pending actions. The argument is the index of the chain.
+  template <class F>
+  void RunAnywhere(F&& action) {
+    std::size_t i = Random() % num_chains_;
+    if (num_chains_ > 1) {
+      std::size_t j = (i + 1 + Random() % (num_chains_ - 1)) % num_chains_;
+      if (Pending(j) < Pending(i)) i = j;
+    }
+    Run(i, std::forward<F>(action));
+  }
+
+  // Runs `action(std::size_t)` on the chain with the specified index.
+  template <class F>
+  void Run(std::size_t i, F&& action) {
+    assert(i < num_chains_);
+    Slot* s = &slots_[i];
+    s->pending.fetch_add(1, std::memory_order_relaxed);
+    s->chain.Run([s, i, action = std::forward<F>(action)]() mutable {
+      std::move(action)(i);
+      s->pending.fetch_sub(1, std::memory_order_relaxed);
+    });
+  }
+
+  // The number of actions on the chain that haven't completed. May be stale.
+  std::size_t Pending(std::size_t i) const {
+    assert(i < num_chains_);
+    return slots_[i].pending.load(std::memory_order_relaxed);
+  }
+
+  std::size_t num_chains() const { return num_chains_; }
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<std::size_t> pending{0};
+    ActionChain chain;
+  };
+
+  // Thread-local xorshift64. Every thread starts from a different state.
+  static std::uint64_t Random() {
+    if (!rng_) rng_ = reinterpret_cast<std::uintptr_t>(&rng_) | 1;
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 7;
+    rng_ ^= rng_ << 17;
+    return rng_;
+  }
+
+  static inline thread_local std::uint64_t rng_ = 0;
+
+  const std::unique_ptr<Slot[]> slots_;
+  const std::size_t num_chains_;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_CHAIN_POOL_H_
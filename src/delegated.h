@@ -0,0 +1,244 @@
+#ifndef ROMKATV_ACTION_CHAIN_DELEGATED_H_
+#define ROMKATV_ACTION_CHAIN_DELEGATED_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "action_chain.h"
+
+// Containers whose data is owned by ActionChain instances. Every operation is shipped
+// to the owning chain as an action, so the data stays in the cache of whichever
+// thread drains the chain instead of bouncing between all threads that use it.
+//
+// Operations don't block. Results are delivered to callbacks, which run on the owning
+// chain. Callbacks must be quick. They may schedule more operations but must not
+// wait for them. A container must not be destroyed while it has pending operations.
+
+namespace romkatv {
+
+// Hash map sharded across several chains.
+//
+// Example:
+//
+//   DelegatedHashMap<std::string, Session> sessions(16);
+//
+//   // Thread-safe. Doesn't block.
+//   void Touch(std::string id, Time now) {
+//     sessions.Find(id, [=](Session* s) {
+//       if (s) s->last_seen = now;
+//     });
+//   }
+template <class K, class V, class Hash = std::hash<K>>
+class DelegatedHashMap {
+ public:
+  explicit DelegatedHashMap(std::size_t num_shards)
+      : shards_(new Shard[num_shards]), n_(num_shards) {
+    assert(num_shards > 0);
+  }
+  DelegatedHashMap(DelegatedHashMap&&) = delete;
+
+  // Inserts the value or replaces the existing one.
+  void Insert(K key, V value) {
+    Shard* s = ShardOf(key);
+    s->chain.Run([s, key = std::move(key), value = std::move(value)]() mutable {
+      s->map.insert_or_assign(std::move(key), std::move(value));
+    });
+  }
+
+  void Erase(K key) {
+    Shard* s = ShardOf(key);
+    s->chain.Run([s, key = std::move(key)] { s->map.erase(key); });
+  }
+
+  // Calls `done(V*)` with the value or null if there is no such key. The pointer is
+  // valid only until `done` returns.
+  template <class Done>
+  void Find(K key, Done&& done) {
+    Shard* s = ShardOf(key);
+    s->chain.Run([s, key = std::move(key), done = std::forward<Done>(done)]() mutable {
+      auto it = s->map.find(key);
+      std::move(done)(it == s->map.end() ? nullptr : &it->second);
+    });
+  }
+
+  // Looks up several keys with one action per shard rather than one per key. Calls
+  // `done(std::vector<std::optional<V>>)` with the results in the order of `keys`.
+  // The callback runs on the chain of the shard that finishes last.
+  template <class Done>
+  void FindMany(std::vector<K> keys, Done&& done) {
+    struct Batch {
+      std::vector<K> keys;
+      std::vector<std::optional<V>> values;
+      std::atomic<std::size_t> shards_left{0};
+      std::decay_t<Done> done;
+    };
+    auto* b = new Batch{std::move(keys), {}, {}, std::forward<Done>(done)};
+    if (b->keys.empty()) {
+      std::move(b->done)(std::move(b->values));
+      delete b;
+      return;
+    }
+    b->values.resize(b->keys.size());
+    std::vector<std::vector<std::size_t>> idx(n_);
+    for (std::size_t i = 0; i != b->keys.size(); ++i) {
+      idx[ShardOf(b->keys[i]) - shards_.get()].push_back(i);
+    }
+    for (const auto& v : idx) b->shards_left.fetch_add(!v.empty(), std::memory_order_relaxed);
+    for (std::size_t i = 0; i != n_; ++i) {
+      if (idx[i].empty()) continue;
+      Shard* s = &shards_[i];
+      s->chain.Run([s, b, idx = std::move(idx[i])] {
+        for (std::size_t j : idx) {
+          auto it = s->map.find(b->keys[j]);
+          if (it != s->map.end()) b->values[j] = it->second;
+        }
+        if (b->shards_left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+          std::move(b->done)(std::move(b->values));
+          delete b;
+        }
+      });
+    }
+  }
+
+ private:
+  struct Shard {
+    ActionChain chain;
+    std::unordered_map<K, V, Hash> map;
+  };
+
+  Shard* ShardOf(const K& key) { return &shards_[Hash()(key) % n_]; }
+
+  std::unique_ptr<Shard[]> shards_;
+  std::size_t n_;
+};
+
+// Priority queue owned by a single chain. Pop() returns the largest element
+// according to Compare.
+template <class T, class Compare = std::less<T>>
+class DelegatedPriorityQueue {
+ public:
+  DelegatedPriorityQueue() {}
+  DelegatedPriorityQueue(DelegatedPriorityQueue&&) = delete;
+
+  void Push(T value) {
+    chain_.Run([this, value = std::move(value)]() mutable {
+      queue_.push(std::move(value));
+    });
+  }
+
+  // Calls `done(std::optional<T>)` with the largest element or nullopt if the queue
+  // is empty.
+  template <class Done>
+  void Pop(Done&& done) {
+    chain_.Run([this, done = std::forward<Done>(done)]() mutable {
+      std::optional<T> res;
+      if (!queue_.empty()) {
+        res = std::move(const_cast<T&>(queue_.top()));
+        queue_.pop();
+      }
+      std::move(done)(std::move(res));
+    });
+  }
+
+  // Pops up to `n` elements in one action. Calls `done(std::vector<T>)` with the
+  // elements from the largest to the smallest.
+  template <class Done>
+  void PopMany(std::size_t n, Done&& done) {
+    chain_.Run([this, n, done = std::forward<Done>(done)]() mutable {
+      std::vector<T> res;
+      res.reserve(std::min(n, queue_.size()));
+      while (res.size() != n && !queue_.empty()) {
+        res.push_back(std::move(const_cast<T&>(queue_.top())));
+        queue_.pop();
+      }
+      std::move(done)(std::move(res));
+    });
+  }
+
+ private:
+  ActionChain chain_;
+  std::priority_queue<T, std::vector<T>, Compare> queue_;
+};
+
+// Double-ended queue with a fixed capacity owned by a single chain.
+template <class T>
+class DelegatedBoundedDeque {
+ public:
+  explicit DelegatedBoundedDeque(std::size_t capacity) : capacity_(capacity) {}
+  DelegatedBoundedDeque(DelegatedBoundedDeque&&) = delete;
+
+  // Calls `done(bool)` with true if the element was added and false if the deque
+  // was full.
+  template <class Done>
+  void PushBack(T value, Done&& done) {
+    Push(true, std::move(value), std::forward<Done>(done));
+  }
+
+  template <class Done>
+  void PushFront(T value, Done&& done) {
+    Push(false, std::move(value), std::forward<Done>(done));
+  }
+
+  // Calls `done(std::optional<T>)` with the removed element or nullopt if the deque
+  // was empty.
+  template <class Done>
+  void PopBack(Done&& done) {
+    chain_.Run([this, done = std::forward<Done>(done)]() mutable {
+      std::optional<T> res;
+      if (!deque_.empty()) {
+        res = std::move(deque_.back());
+        deque_.pop_back();
+      }
+      std::move(done)(std::move(res));
+    });
+  }
+
+  template <class Done>
+  void PopFront(Done&& done) {
+    chain_.Run([this, done = std::forward<Done>(done)]() mutable {
+      std::optional<T> res;
+      if (!deque_.empty()) {
+        res = std::move(deque_.front());
+        deque_.pop_front();
+      }
+      std::move(done)(std::move(res));
+    });
+  }
+
+  // Calls `done(std::size_t)` with the number of elements.
+  template <class Done>
+  void Size(Done&& done) {
+    chain_.Run([this, done = std::forward<Done>(done)]() mutable {
+      std::move(done)(deque_.size());
+    });
+  }
+
+ private:
+  template <class Done>
+  void Push(bool back, T value, Done&& done) {
+    chain_.Run([this, back, value = std::move(value), done = std::forward<Done>(done)]() mutable {
+      bool ok = deque_.size() != capacity_;
+      if (ok && back) deque_.push_back(std::move(value));
+      if (ok && !back) deque_.push_front(std::move(value));
+      std::move(done)(ok);
+    });
+  }
+
+  const std::size_t capacity_;
+  ActionChain chain_;
+  std::deque<T> deque_;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_DELEGATED_H_
@@ -0,0 +1,68 @@
+#include "fair_action_chain.h"
+
+namespace romkatv {
+
+FairActionChain::FairActionChain(const std::vector<std::uint32_t>& weights)
+    : tenants_(new Tenant[weights.size()]), num_tenants_(weights.size()) {
+  assert(num_tenants_ > 0);
+  for (std::size_t i = 0; i != num_tenants_; ++i) {
+    assert(weights[i] > 0);
+    Tenant& t = tenants_[i];
+    t.head = new Node;
+    t.tail.store(t.head, std::memory_order_relaxed);
+    t.weight = weights[i];
+  }
+}
+
+FairActionChain::~FairActionChain() {
+  assert(pending_.load(std::memory_order_acquire) == 0);
+  for (std::size_t i = 0; i != num_tenants_; ++i) {
+    assert(tenants_[i].head == tenants_[i].tail.load(std::memory_order_relaxed));
+    delete tenants_[i].head;
+  }
+}
+
+FairActionChain::Node* FairActionChain::Pop(Tenant* t) {
+  Node* next = t->head->next_.load(std::memory_order_acquire);
+  if (!next) return nullptr;
+  delete std::exchange(t->head, next);
+  return next;
+}
+
+void FairActionChain::Drain() {
+  // The number of tenants in a row that had nothing to run.
+  std::size_t idle = 0;
+  while (true) {
+    Tenant* t = &tenants_[cur_];
+    if (!t->quota) t->quota = t->weight;
+    Node* node = Pop(t);
+    if (!node) {
+      t->quota = 0;
+      cur_ = (cur_ + 1) % num_tenants_;
+      if (++idle == num_tenants_) {
+        // pending_ says there are actions but their producers haven't linked them yet
+        // and may have been preempted. Rather than wait, let them take over.
+        if (!Abandon()) return;
+        idle = 0;
+      }
+      continue;
+    }
+    idle = 0;
+    node->Run();
+    if (!--t->quota) cur_ = (cur_ + 1) % num_tenants_;
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) return;
+  }
+}
+
+bool FairActionChain::Abandon() {
+  pending_.fetch_or(kAbandoned, std::memory_order_acq_rel);
+  // Producers that incremented pending_ after this will see kAbandoned. Those that did
+  // it before won't, but their links are visible now. If any action is ready, the drain
+  // must not be left idle.
+  for (std::size_t i = 0; i != num_tenants_; ++i) {
+    if (tenants_[i].head->next_.load(std::memory_order_acquire)) return TakeOver();
+  }
+  return false;
+}
+
+}  // namespace romkatv
@@ -0,0 +1,125 @@
+#ifndef ROMKATV_ACTION_CHAIN_FAIR_ACTION_CHAIN_H_
+#define ROMKATV_ACTION_CHAIN_FAIR_ACTION_CHAIN_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace romkatv {
+
+// Like ActionChain but actions belong to tenants, and a tenant that adds many actions
+// doesn't delay the actions of other tenants by much. Actions of the same tenant run
+// in the order they were added. Actions of different tenants are interleaved by
+// weighted round-robin: when several tenants have pending actions, the drainer runs up
+// to `weight` actions of one tenant before moving on to the next. A tenant that has
+// run out of actions loses the rest of its turn.
+//
+// Every tenant has its own wait-free queue. Run() appends to it and becomes the
+// drainer if no other thread is draining. If the drainer finds only actions whose
+// producers haven't finished appending them, it doesn't wait: the next producer to
+// finish takes over the drain.
+//
+// Example:
+//
+//   // Tenant 0 is interactive and gets 4 times the share of tenant 1, which is batch.
+//   FairActionChain mutex({4, 1});
+//
+//   void Serve(Request* req) {
+//     mutex.Run(req->interactive() ? 0 : 1, [=] { Process(req); });
+//   }
+class FairActionChain {
+ public:
+  // `weights[i]` is the weight of tenant i. Must be positive.
+  explicit FairActionChain(const std::vector<std::uint32_t>& weights);
+  FairActionChain(FairActionChain&&) = delete;
+  // There must be no pending actions.
+  ~FairActionChain();
+
+  // Either executes `action` synchronously (in which case other pending actions may
+  // also run synchronously after it) or schedules it for execution after all
+  // previously scheduled actions of the same tenant have completed.
+  template <class F>
+  void Run(std::size_t tenant, F&& action) {
+    assert(tenant < num_tenants_);
+    Node* node = new NodeImpl<std::decay_t<F>>(std::forward<F>(action));
+    tenants_[tenant].tail.exchange(node, std::memory_order_acq_rel)
+        ->next_.store(node, std::memory_order_release);
+    std::uint64_t prev = pending_.fetch_add(1, std::memory_order_acq_rel);
+    if (prev == 0 || ((prev & kAbandoned) && TakeOver())) Drain();
+  }
+
+  std::size_t num_tenants() const { return num_tenants_; }
+
+ private:
+  class Node {
+   public:
+    virtual ~Node() = default;
+    virtual void Run() {}
+
+    std::atomic<Node*> next_{nullptr};
+  };
+
+  template <class F>
+  class NodeImpl : public Node {
+   public:
+    template <class FF>
+    explicit NodeImpl(FF&& action) : action_(std::forward<FF>(action)) {}
+
+    // Captured state is destroyed right away even though the node lives on as the
+    // head of its queue.
+    void Run() override {
+      std::move(*action_)();
+      action_.reset();
+    }
+
+   private:
+    std::optional<F> action_;
+  };
+
+  struct Tenant {
+    // The last node. Written by producers.
+    alignas(64) std::atomic<Node*> tail;
+    // The rest is accessed only by the drainer. The node that has run most recently.
+    // Pending nodes follow it.
+    alignas(64) Node* head;
+    std::uint32_t weight;
+    // How many more actions of this tenant can run before the next tenant's turn.
+    std::uint32_t quota = 0;
+  };
+
+  // Set in pending_ by a drainer that has given up the drain because pending actions
+  // weren't linked yet.
+  static constexpr std::uint64_t kAbandoned = std::uint64_t{1} << 63;
+
+  // Runs actions until there are none. The calling thread must own the drain.
+  void Drain();
+  // Gives up the drain. Returns false on success, or true if the caller must keep
+  // draining because some actions became ready to run in the meantime.
+  bool Abandon();
+  // Takes over an abandoned drain. Returns true on success.
+  bool TakeOver() {
+    return pending_.fetch_and(~kAbandoned, std::memory_order_acq_rel) & kAbandoned;
+  }
+  // Returns the next action of `t` or null if there is none or its producer hasn't
+  // linked it yet.
+  static Node* Pop(Tenant* t);
+
+  // The number of actions added but not run, plus kAbandoned. The thread that
+  // increments it from zero or clears kAbandoned owns the drain until it decrements it
+  // back to zero or sets kAbandoned.
+  alignas(64) std::atomic<std::uint64_t> pending_{0};
+  const std::unique_ptr<Tenant[]> tenants_;
+  const std::size_t num_tenants_;
+  // Accessed only by the drainer. The tenant whose turn it is.
+  std::size_t cur_ = 0;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_FAIR_ACTION_CHAIN_H_
@@ -0,0 +1,55 @@
+#include "keyed_action_chain.h"
+
+#include <cassert>
+
+namespace romkatv {
+
+KeyedActionChain::KeyedActionChain(std::size_t num_helpers) : helpers_(num_helpers) {}
+
+KeyedActionChain::~KeyedActionChain() {
+  std::unique_lock lock(mutex_);
+  idle_.wait(lock, [&] { return pending_.load(std::memory_order_acquire) == 0; });
+}
+
+void KeyedActionChain::Add(Task* task) {
+  for (Key key : task->keys_) {
+    Task*& last = last_[key];
+    if (last == task) continue;
+    if (last) {
+      // `last` may block `task` via several keys. Count it once.
+      if (last->dependents_.empty() || last->dependents_.back() != task) {
+        last->dependents_.push_back(task);
+        ++task->blockers_;
+      }
+    }
+    last = task;
+  }
+  if (!task->blockers_) Dispatch(task);
+}
+
+void KeyedActionChain::Complete(Task* task) {
+  for (Key key : task->keys_) {
+    auto it = last_.find(key);
+    if (it != last_.end() && it->second == task) last_.erase(it);
+  }
+  for (Task* t : task->dependents_) {
+    assert(t->blockers_ > 0);
+    if (!--t->blockers_) Dispatch(t);
+  }
+  delete task;
+}
+
+void KeyedActionChain::Dispatch(Task* task) {
+  helpers_.Schedule([this, task] {
+    task->Run();
+    chain_.Run([this, task] { Complete(task); });
+    // The destructor waits for this. Once the last helper is here, nothing else runs
+    // on chain_ because all Complete() calls are made from helpers.
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard lock(mutex_);
+      idle_.notify_all();
+    }
+  });
+}
+
+}  // namespace romkatv
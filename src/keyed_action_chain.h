@@ -0,0 +1,113 @@
+#ifndef ROMKATV_ACTION_CHAIN_KEYED_ACTION_CHAIN_H_
+#define ROMKATV_ACTION_CHAIN_KEYED_ACTION_CHAIN_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "action_chain.h"
+#include "thread_pool.h"
+
+namespace romkatv {
+
+// Like ActionChain but every action declares the set of keys it touches. Actions that
+// share at least one key run in the order they were added. Actions that don't
+// conflict run in parallel on helper threads.
+//
+// Scheduling is performed by an internal ActionChain that tracks the last pending
+// action for every key. An action is handed to a helper thread once all earlier
+// actions that share keys with it have completed.
+//
+// Example:
+//
+//   std::vector<Account> accounts;  // accounts[i] is guarded by key i
+//   KeyedActionChain mutex(4);
+//
+//   // Thread-safe. Transfers between disjoint pairs of accounts run in parallel.
+//   void Transfer(std::uint64_t from, std::uint64_t to, Money amount) {
+//     mutex.Run({from, to}, [=] {
+//       accounts[from].balance -= amount;
+//       accounts[to].balance += amount;
+//     });
+//   }
+class KeyedActionChain {
+ public:
+  using Key = std::uint64_t;
+
+  // Zero helpers is treated as one.
+  explicit KeyedActionChain(std::size_t num_helpers);
+  KeyedActionChain(KeyedActionChain&&) = delete;
+  // Waits for all actions to complete. Run() must not be called concurrently with
+  // the destructor.
+  ~KeyedActionChain();
+
+  // Schedules `action` for execution on one of the helper threads after all
+  // previously scheduled actions that share keys with it have completed. Keys may
+  // repeat.
+  template <class F>
+  void Run(const Key* keys, std::size_t num_keys, F&& action) {
+    Task* task = new TaskImpl<std::decay_t<F>>(std::forward<F>(action));
+    task->keys_.assign(keys, keys + num_keys);
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    chain_.Run([this, task] { Add(task); });
+  }
+
+  template <class F>
+  void Run(std::initializer_list<Key> keys, F&& action) {
+    Run(keys.begin(), keys.size(), std::forward<F>(action));
+  }
+
+ private:
+  class Task {
+   public:
+    virtual ~Task() = default;
+    virtual void Run() = 0;
+
+    std::vector<Key> keys_;
+    // Tasks that can't start before this one completes.
+    std::vector<Task*> dependents_;
+    // The number of incomplete tasks that must complete before this one starts.
+    std::size_t blockers_ = 0;
+  };
+
+  template <class F>
+  class TaskImpl : public Task {
+   public:
+    template <class FF>
+    explicit TaskImpl(FF&& action) : action_(std::forward<FF>(action)) {}
+
+    void Run() override { std::move(action_)(); }
+
+   private:
+    F action_;
+  };
+
+  // These are called on chain_.
+  void Add(Task* task);
+  void Complete(Task* task);
+  void Dispatch(Task* task);
+
+  // The number of tasks whose helpers haven't returned yet.
+  std::atomic<std::size_t> pending_{0};
+  std::mutex mutex_;
+  std::condition_variable idle_;
+
+  // Guarded by chain_. The last incomplete task for every key.
+  std::unordered_map<Key, Task*> last_;
+  ActionChain chain_;
+
+  // Must be the last member so that helpers are joined before anything else is
+  // destroyed.
+  ThreadPool helpers_;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_KEYED_ACTION_CHAIN_H_
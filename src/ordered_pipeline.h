@@ -0,0 +1,146 @@
+#ifndef ROMKATV_ACTION_CHAIN_ORDERED_PIPELINE_H_
+#define ROMKATV_ACTION_CHAIN_ORDERED_PIPELINE_H_
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "action_chain.h"
+#include "thread_pool.h"
+
+namespace romkatv {
+
+// Passes items through a sequence of stages. Parallel stages process several items
+// at once on a thread pool. Serial stages process one item at a time, in the order
+// the items were submitted.
+//
+// Every serial stage is an ActionChain fed by a reorder buffer. Items that complete
+// the previous stage out of order wait in the buffer until all items submitted
+// before them have passed the serial stage.
+//
+// Example:
+//
+//   ThreadPool pool(8);
+//   OrderedPipeline<Record> pipeline(&pool);
+//   pipeline.AddParallelStage([](Record& r) { r.Parse(); });
+//   pipeline.AddSerialStage([&](Record& r) { db.Apply(r); });
+//   while (std::optional<Record> r = Read()) pipeline.Submit(std::move(*r));
+//   pipeline.Wait();
+template <class T>
+class OrderedPipeline {
+ public:
+  using StageFn = std::function<void(T&)>;
+
+  explicit OrderedPipeline(ThreadPool* pool) : pool_(pool) { assert(pool); }
+  OrderedPipeline(OrderedPipeline&&) = delete;
+  ~OrderedPipeline() { Wait(); }
+
+  // Stages must be added before the first item is submitted.
+  void AddParallelStage(StageFn f) { stages_.emplace_back(new Stage(false, std::move(f))); }
+  void AddSerialStage(StageFn f) { stages_.emplace_back(new Stage(true, std::move(f))); }
+
+  // Must not be called concurrently with itself or with Wait().
+  void Submit(T value) {
+    Acquire(2);
+    Item* item = new Item{next_seq_++, 0, std::move(value)};
+    Process(item);
+    Release();
+  }
+
+  // Blocks until all submitted items have passed through all stages.
+  void Wait() {
+    std::unique_lock lock(mutex_);
+    idle_.wait(lock, [&] { return pending_.load(std::memory_order_acquire) == 0; });
+  }
+
+ private:
+  struct Item {
+    std::uint64_t seq;
+    // The index of the next stage.
+    std::size_t stage;
+    T value;
+  };
+
+  struct LaterSeq {
+    bool operator()(const Item* x, const Item* y) const { return x->seq > y->seq; }
+  };
+
+  struct Stage {
+    Stage(bool serial, StageFn f) : serial(serial), f(std::move(f)) {}
+
+    const bool serial;
+    const StageFn f;
+    // The rest is used only by serial stages and is guarded by `chain`.
+    std::priority_queue<Item*, std::vector<Item*>, LaterSeq> reorder;
+    std::uint64_t next_seq = 0;
+    ActionChain chain;
+  };
+
+  // Passes the item to its next stage.
+  void Process(Item* item) {
+    if (item->stage == stages_.size()) {
+      delete item;
+      Release();
+      return;
+    }
+    Stage* stage = stages_[item->stage].get();
+    if (stage->serial) {
+      stage->chain.Run([this, item] { Reorder(item); });
+    } else {
+      Acquire(1);
+      pool_->Schedule([this, item] {
+        stages_[item->stage++]->f(item->value);
+        Process(item);
+        Release();
+      });
+    }
+  }
+
+  // Runs on the chain of a serial stage.
+  void Reorder(Item* item) {
+    Stage* stage = stages_[item->stage].get();
+    stage->reorder.push(item);
+    while (!stage->reorder.empty() && stage->reorder.top()->seq == stage->next_seq) {
+      item = stage->reorder.top();
+      stage->reorder.pop();
+      ++stage->next_seq;
+      stage->f(item->value);
+      ++item->stage;
+      Process(item);
+    }
+  }
+
+  // pending_ counts items in flight plus threads that are executing pipeline code.
+  // Once it drops to zero, no thread touches the pipeline, so it's safe to destroy.
+  void Acquire(std::uint64_t n) { pending_.fetch_add(n, std::memory_order_relaxed); }
+
+  void Release() {
+    std::uint64_t n = pending_.load(std::memory_order_relaxed);
+    while (n > 1) {
+      if (pending_.compare_exchange_weak(n, n - 1, std::memory_order_acq_rel)) return;
+    }
+    // Possibly the last one. Decrement under the lock, so that Wait() can't return
+    // while we are still notifying.
+    std::lock_guard lock(mutex_);
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) idle_.notify_all();
+  }
+
+  ThreadPool* const pool_;
+  std::vector<std::unique_ptr<Stage>> stages_;
+  std::uint64_t next_seq_ = 0;
+  std::atomic<std::uint64_t> pending_{0};
+  std::mutex mutex_;
+  std::condition_variable idle_;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_ORDERED_PIPELINE_H_
@@ -0,0 +1,34 @@
+#include "rate_limited_action_chain.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace romkatv {
+
+RateLimitedActionChain::RateLimitedActionChain(double rate, std::uint64_t burst)
+    : period_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::duration<double>(1 / rate))),
+      burst_window_(period_ * static_cast<std::int64_t>(burst - 1)) {
+  assert(rate > 0 && burst > 0);
+  assert(period_.count() > 0);
+}
+
+bool RateLimitedActionChain::TakeToken() {
+  Timer::Clock::time_point now = Timer::Clock::now();
+  if (full_at_ <= now + burst_window_) {
+    full_at_ = std::max(full_at_, now) + period_;
+    return true;
+  }
+  if (!armed_) {
+    armed_ = true;
+    timer_.Schedule(full_at_ - burst_window_, [this] {
+      chain_.Run([this] {
+        armed_ = false;
+        chain_.Notify(&tokens_);
+      });
+    });
+  }
+  return false;
+}
+
+}  // namespace romkatv
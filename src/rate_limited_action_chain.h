@@ -0,0 +1,79 @@
+#ifndef ROMKATV_ACTION_CHAIN_RATE_LIMITED_ACTION_CHAIN_H_
+#define ROMKATV_ACTION_CHAIN_RATE_LIMITED_ACTION_CHAIN_H_
+
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+#include "action_chain.h"
+#include "timer.h"
+
+namespace romkatv {
+
+// Like ActionChain but runs at most `rate` actions per second on average, and at most
+// `burst` actions back to back after a pause. Useful for chains that drive downstream
+// systems with a limited capacity.
+//
+// Actions that are over the limit are parked, so Run() doesn't block, and neither does
+// the drainer: when it runs out of tokens, it leaves. A timer thread resumes the
+// drain when the next token becomes available. Every wakeup of the timer thread takes
+// time, so at high rates `burst` should cover a few milliseconds' worth of actions to
+// let the chain catch up after a late wakeup. With `burst = 1` the achieved rate falls
+// short.
+//
+// Example:
+//
+//   // At most 100 compactions per second.
+//   RateLimitedActionChain compactions(100);
+//
+//   void OnFlush(Segment* s) {
+//     compactions.Run([=] { Compact(s); });
+//   }
+class RateLimitedActionChain {
+ public:
+  explicit RateLimitedActionChain(double rate, std::uint64_t burst = 1);
+  RateLimitedActionChain(RateLimitedActionChain&&) = delete;
+  // There must be no pending actions.
+  ~RateLimitedActionChain() = default;
+
+  // Same as ActionChain::Run(). Actions run in the order they were added.
+  template <class F>
+  void Run(ActionChain::Mem* mem, F&& action) {
+    chain_.RunWhen(mem, &tokens_, [this] { return TakeToken(); }, std::forward<F>(action));
+  }
+
+  template <class F>
+  void Run(F&& action) {
+    chain_.RunWhen(&tokens_, [this] { return TakeToken(); }, std::forward<F>(action));
+  }
+
+ private:
+  // Called on the chain before every action. Returns false if the action must wait
+  // for a token, in which case it arranges for the timer to retry.
+  bool TakeToken();
+
+  // The time it takes to earn one token.
+  const std::chrono::nanoseconds period_;
+  // The time it takes to earn `burst - 1` tokens.
+  const std::chrono::nanoseconds burst_window_;
+
+  ActionChain chain_;
+  // Notified by the timer when the next token is available.
+  ActionChain::Condition tokens_;
+
+  // Guarded by chain_.
+  //
+  // The time at which the bucket would be full if no action ran from now on, plus
+  // one period. An action can run if this is at most `burst_window_` in the future.
+  Timer::Clock::time_point full_at_;
+  // True if the timer is going to notify `tokens_`.
+  bool armed_ = false;
+
+  // Must be the last member so that the timer thread is joined before anything else is
+  // destroyed.
+  Timer timer_;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_RATE_LIMITED_ACTION_CHAIN_H_
@@ -0,0 +1,47 @@
+#include "reclaimer.h"
+
+#include <algorithm>
+
+namespace romkatv {
+
+Reclaimer::Reader::Reader(Reclaimer* r) : r_(r) {
+  std::lock_guard lock(r_->mutex_);
+  r_->readers_.push_back(this);
+  Quiesce();
+}
+
+Reclaimer::Reader::~Reader() {
+  std::lock_guard lock(r_->mutex_);
+  auto it = std::find(r_->readers_.begin(), r_->readers_.end(), this);
+  assert(it != r_->readers_.end());
+  r_->readers_.erase(it);
+}
+
+Reclaimer::~Reclaimer() {
+  assert(readers_.empty());
+  for (const Retired& r : retired_) r.del(r.p);
+}
+
+void Reclaimer::Reclaim() {
+  // Readers that see the new epoch in Quiesce() can't reach anything retired so far.
+  std::uint64_t epoch = epoch_.load(std::memory_order_relaxed);
+  epoch_.store(epoch + 1, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  std::uint64_t min_seen = kOffline;
+  {
+    std::lock_guard lock(mutex_);
+    for (const Reader* r : readers_) {
+      min_seen = std::min(min_seen, r->seen_.load(std::memory_order_acquire));
+    }
+  }
+  auto it = retired_.begin();
+  while (it != retired_.end() && it->epoch < min_seen) {
+    it->del(it->p);
+    ++it;
+  }
+  retired_.erase(retired_.begin(), it);
+  // If a reader lags, wait for another batch rather than retrying on every Retire().
+  next_reclaim_ = retired_.size() + batch_;
+}
+
+}  // namespace romkatv
@@ -0,0 +1,136 @@
+#ifndef ROMKATV_ACTION_CHAIN_RECLAIMER_H_
+#define ROMKATV_ACTION_CHAIN_RECLAIMER_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "action_chain.h"
+
+namespace romkatv {
+
+// Quiescent-state-based reclamation for data owned by an ActionChain and read without
+// synchronization by other threads.
+//
+// Actions on the chain replace objects that readers may still be looking at and
+// Retire() the old ones. Reader threads call Reader::Quiesce() at points where they
+// don't hold pointers to such objects, for example between requests. A retired object
+// is freed by the drainer once every reader has passed through Quiesce() after the
+// object was retired. This costs readers a load and a store per Quiesce() and no
+// atomic read-modify-write operations.
+//
+// Example:
+//
+//   std::atomic<const Config*> config;
+//   ActionChain mutex;
+//   Reclaimer reclaimer(&mutex);
+//
+//   // Thread-safe.
+//   void SetConfig(const Config* c) {
+//     mutex.Run([=] { reclaimer.Retire(config.exchange(c, std::memory_order_acq_rel)); });
+//   }
+//
+//   void ServeForever() {
+//     Reclaimer::Reader reader(&reclaimer);
+//     while (Request* req = NextRequest()) {
+//       Serve(req, config.load(std::memory_order_acquire));
+//       reader.Quiesce();
+//     }
+//   }
+class Reclaimer {
+ public:
+  // A thread that reads objects retired with Retire(). Not thread-safe.
+  class Reader {
+   public:
+    explicit Reader(Reclaimer* r);
+    Reader(Reader&&) = delete;
+    ~Reader();
+
+    // Announces that this thread holds no pointers to objects that might be retired.
+    void Quiesce() {
+      bool offline = seen_.load(std::memory_order_relaxed) == kOffline;
+      seen_.store(r_->epoch_.load(std::memory_order_acquire), std::memory_order_release);
+      // Pairs with the fence in Reclaim(). Either it sees that we are back, or we see
+      // everything retired before it skipped us.
+      if (offline) std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    // Tells the reclaimer not to wait for this thread until the next call to
+    // Quiesce(). Call it before blocking for a long time. Implies Quiesce().
+    void Offline() { seen_.store(kOffline, std::memory_order_release); }
+
+   private:
+    friend class Reclaimer;
+
+    Reclaimer* const r_;
+    // Written only by the reader. The value of `epoch_` at the last Quiesce().
+    alignas(64) std::atomic<std::uint64_t> seen_{kOffline};
+  };
+
+  // Retired objects are freed in batches of `batch` or more.
+  explicit Reclaimer(ActionChain* chain, std::size_t batch = 64) : chain_(chain), batch_(batch) {
+    assert(chain && batch > 0);
+  }
+  Reclaimer(Reclaimer&&) = delete;
+  // Frees all retired objects. There must be no readers and no pending actions that
+  // call Retire().
+  ~Reclaimer();
+
+  // Must be called from an action on the chain after `p` has been made unreachable
+  // for readers. Deletes `p` once no reader can hold it. Null is ignored.
+  template <class T>
+  void Retire(T* p) {
+    if (!p) return;
+    retired_.push_back({const_cast<void*>(static_cast<const void*>(p)),
+                        [](void* p) { delete static_cast<T*>(p); },
+                        epoch_.load(std::memory_order_relaxed)});
+    if (retired_.size() >= next_reclaim_) Reclaim();
+  }
+
+  // Thread-safe. Frees retired objects that are no longer in use on the chain. Normally
+  // they are freed by Retire() but if actions stop retiring objects, the last batch
+  // waits for this call.
+  void Collect() {
+    chain_->Run([this] { Reclaim(); });
+  }
+
+  // The number of objects that have been retired but not freed. Must be called from
+  // an action on the chain.
+  std::size_t pending() const { return retired_.size(); }
+
+ private:
+  static constexpr std::uint64_t kOffline = std::numeric_limits<std::uint64_t>::max();
+
+  struct Retired {
+    void* p;
+    void (*del)(void*);
+    // The value of epoch_ when the object was retired.
+    std::uint64_t epoch;
+  };
+
+  // Starts a new epoch and frees objects that all readers have seen retired. Called
+  // on the chain.
+  void Reclaim();
+
+  ActionChain* const chain_;
+  const std::size_t batch_;
+  // Written only on the chain. Incremented by Reclaim().
+  alignas(64) std::atomic<std::uint64_t> epoch_{0};
+
+  // Guarded by chain_. In the order of retirement.
+  std::vector<Retired> retired_;
+  // Retire() calls Reclaim() when retired_ has this many objects.
+  std::size_t next_reclaim_ = batch_;
+
+  std::mutex mutex_;
+  // Guarded by mutex_.
+  std::vector<Reader*> readers_;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_RECLAIMER_H_
@@ -0,0 +1,141 @@
+#include "shared_action_chain.h"
+
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <thread>
+
+namespace romkatv {
+
+namespace {
+
+constexpr std::uint32_t kNull = 0;
+constexpr std::uint32_t kSealed = ~std::uint32_t{0};
+constexpr std::uint64_t kMagic = 0x6e6961686341534b;
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+}  // namespace
+
+struct SharedActionChain::Header {
+  std::uint64_t magic;
+  std::uint32_t num_nodes;
+  // Free nodes linked via Node::free_next. The index of the first node is in the low
+  // 32 bits. The high 32 bits are incremented on every update to avoid ABA.
+  alignas(64) std::atomic<std::uint64_t> free;
+  // Written by all producers. Kept away from `free`, which is also written by
+  // the drainer.
+  alignas(64) std::atomic<std::uint32_t> tail;
+};
+
+// Indices start from 1. Zero is null.
+struct alignas(64) SharedActionChain::Node {
+  std::atomic<std::uint32_t> next;
+  std::atomic<std::uint32_t> free_next;
+  std::uint32_t opcode;
+  std::uint32_t size;
+  alignas(8) unsigned char payload[kMaxPayload];
+};
+
+std::size_t SharedActionChain::RegionSize(std::uint32_t num_nodes, std::size_t data_size) {
+  return sizeof(Header) + num_nodes * sizeof(Node) + data_size;
+}
+
+void SharedActionChain::Init(void* region, std::uint32_t num_nodes) {
+  static_assert(sizeof(Node) == 64);
+  assert(region && reinterpret_cast<std::uintptr_t>(region) % alignof(Node) == 0);
+  assert(num_nodes >= 2 && num_nodes < kSealed);
+  Header* h = new (region) Header;
+  h->magic = kMagic;
+  h->num_nodes = num_nodes;
+  Node* nodes = reinterpret_cast<Node*>(h + 1);
+  for (std::uint32_t i = 0; i != num_nodes; ++i) {
+    Node* n = new (&nodes[i]) Node;
+    n->next.store(kNull, std::memory_order_relaxed);
+    n->free_next.store(i + 2 > num_nodes ? kNull : i + 2, std::memory_order_relaxed);
+  }
+  // The first node is the tail. It's sealed as if it has already run.
+  nodes[0].next.store(kSealed, std::memory_order_relaxed);
+  h->tail.store(1, std::memory_order_relaxed);
+  h->free.store(2, std::memory_order_release);
+}
+
+SharedActionChain::SharedActionChain(void* region)
+    : header_(static_cast<Header*>(region)), nodes_(reinterpret_cast<Node*>(header_ + 1)) {
+  assert(header_->magic == kMagic);
+  data_ = nodes_ + header_->num_nodes;
+}
+
+void SharedActionChain::Run(std::uint32_t opcode, const void* payload, std::size_t size) {
+  assert(opcode < kMaxOpcodes && handlers_[opcode]);
+  assert(size <= kMaxPayload);
+  std::uint32_t idx = Alloc();
+  Node* n = At(idx);
+  n->opcode = opcode;
+  n->size = size;
+  std::memcpy(n->payload, payload, size);
+  n->next.store(kNull, std::memory_order_relaxed);
+  ContinueWith(header_->tail.exchange(idx, std::memory_order_acq_rel), idx);
+}
+
+SharedActionChain::Node* SharedActionChain::At(std::uint32_t idx) const {
+  assert(idx != kNull && idx <= header_->num_nodes);
+  return &nodes_[idx - 1];
+}
+
+std::uint32_t SharedActionChain::Alloc() {
+  std::uint64_t head = header_->free.load(std::memory_order_acquire);
+  while (true) {
+    std::uint32_t idx = static_cast<std::uint32_t>(head);
+    if (idx == kNull) {
+      std::this_thread::yield();
+      head = header_->free.load(std::memory_order_acquire);
+      continue;
+    }
+    // The node may be allocated and freed by someone else while we are here. Then the
+    // tag changes and the CAS fails.
+    std::uint64_t next = At(idx)->free_next.load(std::memory_order_relaxed);
+    if (header_->free.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | next,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+      return idx;
+    }
+  }
+}
+
+void SharedActionChain::Free(std::uint32_t idx) {
+  Node* n = At(idx);
+  std::uint64_t head = header_->free.load(std::memory_order_relaxed);
+  do {
+    n->free_next.store(static_cast<std::uint32_t>(head), std::memory_order_relaxed);
+  } while (!header_->free.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | idx,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+}
+
+void SharedActionChain::ContinueWith(std::uint32_t prev, std::uint32_t next) {
+  Node* p = At(prev);
+  if (p->next.load(std::memory_order_acquire) != kNull ||
+      p->next.exchange(next, std::memory_order_acq_rel) != kNull) {
+    // `prev` has run and sealed. We own the drain.
+    Free(prev);
+    RunAll(next);
+  }
+}
+
+void SharedActionChain::RunAll(std::uint32_t idx) {
+  while (true) {
+    Node* n = At(idx);
+    handlers_[n->opcode](data_, n->payload, n->size);
+    std::uint32_t next = n->next.load(std::memory_order_acquire);
+    if (next == kNull && (next = n->next.exchange(kSealed, std::memory_order_acq_rel)) == kNull) {
+      return;
+    }
+    assert(next != kSealed);
+    Free(idx);
+    idx = next;
+  }
+}
+
+}  // namespace romkatv
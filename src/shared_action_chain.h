@@ -0,0 +1,96 @@
+#ifndef ROMKATV_ACTION_CHAIN_SHARED_ACTION_CHAIN_H_
+#define ROMKATV_ACTION_CHAIN_SHARED_ACTION_CHAIN_H_
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace romkatv {
+
+// Like ActionChain but lives in memory shared by several processes, such as a
+// MAP_SHARED mapping. Any attached process can run actions and drain the chain.
+//
+// Nodes come from a fixed pool in the shared region and refer to each other by index,
+// so the region may be mapped at different addresses in different processes. Actions
+// are opcodes with trivially copyable payloads rather than lambdas. Every process
+// must register the same handlers for the same opcodes before calling Run().
+//
+// If a process dies while draining the chain, the chain gets stuck.
+//
+// Example:
+//
+//   struct Stats {
+//     uint64_t requests;
+//   };
+//
+//   enum Op : uint32_t { kAddRequests };
+//
+//   // In the parent process.
+//   size_t size = SharedActionChain::RegionSize(64, sizeof(Stats));
+//   void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+//                       -1, 0);
+//   SharedActionChain::Init(region, 64);
+//
+//   // In every child process after fork().
+//   SharedActionChain chain(region);
+//   chain.Register(kAddRequests, [](void* data, const void* payload, size_t) {
+//     static_cast<Stats*>(data)->requests += *static_cast<const uint64_t*>(payload);
+//   });
+//   uint64_t n = 42;
+//   chain.Run(kAddRequests, &n, sizeof(n));
+class SharedActionChain {
+ public:
+  // Runs an action. `data` points to the user data in the shared region. `payload`
+  // points to a copy of the bytes passed to Run(), aligned to 8.
+  using Handler = void (*)(void* data, const void* payload, std::size_t size);
+
+  static constexpr std::size_t kMaxPayload = 48;
+  static constexpr std::uint32_t kMaxOpcodes = 256;
+
+  // Returns the size of a region with `num_nodes` nodes and `data_size` bytes of user
+  // data.
+  static std::size_t RegionSize(std::uint32_t num_nodes, std::size_t data_size);
+
+  // Lays out a chain in `region`, which must be aligned to 64 and have RegionSize()
+  // bytes. Doesn't touch user data. Must be called once before any process attaches.
+  // At most `num_nodes - 1` actions can be pending at a time.
+  static void Init(void* region, std::uint32_t num_nodes);
+
+  // Attaches to a chain laid out by Init(). The region must stay mapped while this
+  // object is alive.
+  explicit SharedActionChain(void* region);
+  SharedActionChain(SharedActionChain&&) = delete;
+
+  void Register(std::uint32_t opcode, Handler handler) {
+    assert(opcode < kMaxOpcodes);
+    handlers_[opcode] = handler;
+  }
+
+  // Like ActionChain::Run(). Copies `size` bytes from `payload` into the shared region.
+  // Spins while all nodes are in use. Handlers must not call Run() on the same chain:
+  // they could wait for a node that only they can free.
+  void Run(std::uint32_t opcode, const void* payload, std::size_t size);
+
+  void* data() const { return data_; }
+
+ private:
+  struct Header;
+  struct Node;
+
+  Node* At(std::uint32_t idx) const;
+  std::uint32_t Alloc();
+  void Free(std::uint32_t idx);
+  // Same as ActionChain::Work::ContinueWith() and RunAll() but with indices.
+  void ContinueWith(std::uint32_t prev, std::uint32_t next);
+  void RunAll(std::uint32_t idx);
+
+  Header* header_;
+  Node* nodes_;
+  void* data_;
+  // Process-local. Handlers can have different addresses in different processes.
+  Handler handlers_[kMaxOpcodes] = {};
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_SHARED_ACTION_CHAIN_H_
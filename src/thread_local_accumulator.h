@@ -0,0 +1,109 @@
+#ifndef ROMKATV_ACTION_CHAIN_THREAD_LOCAL_ACCUMULATOR_H_
+#define ROMKATV_ACTION_CHAIN_THREAD_LOCAL_ACCUMULATOR_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+#include "action_chain.h"
+
+namespace romkatv {
+
+// Aggregate of values added by many threads, such as a hot counter or a histogram.
+// Every thread adds values to its own Local, which merges them into the shared total
+// through an ActionChain once in a while. This costs one action per many additions
+// instead of one per addition.
+//
+// Merge must be default-constructible and callable as `T(const T&, const T&)`. It
+// must be associative and commutative, with `T()` as the identity.
+//
+// Example:
+//
+//   ThreadLocalAccumulator<uint64_t> requests;
+//
+//   void ServeForever() {
+//     ThreadLocalAccumulator<uint64_t>::Local local(&requests);
+//     while (Request* req = NextRequest()) {
+//       Serve(req);
+//       local.Add(1);
+//     }
+//   }
+//
+//   void Report() {
+//     requests.Read([](uint64_t n) { std::cout << "requests: " << n << std::endl; });
+//   }
+template <class T, class Merge = std::plus<T>>
+class ThreadLocalAccumulator {
+ public:
+  struct Options {
+    // Local flushes after this many additions.
+    std::uint64_t flush_every = 1024;
+    // Best-effort bound on staleness: Local flushes on an addition if at least this
+    // much time has passed since its last flush. The time is checked only in Add(),
+    // once every kTimeCheckPeriod additions, and there is no timer, so values of a
+    // Local that stops adding stay unflushed until Flush() or the destructor.
+    std::chrono::nanoseconds max_delay = std::chrono::milliseconds(10);
+  };
+
+  // Values added to a thread's Local. Not thread-safe.
+  class Local {
+   public:
+    explicit Local(ThreadLocalAccumulator* acc) : acc_(acc), last_flush_(CoarseNow()) {}
+    Local(Local&&) = delete;
+    ~Local() { Flush(); }
+
+    void Add(const T& x) {
+      value_ = acc_->merge_(value_, x);
+      ++pending_;
+      if (pending_ == acc_->opt_.flush_every ||
+          (pending_ % kTimeCheckPeriod == 0 &&
+           CoarseNow() - last_flush_ >= acc_->opt_.max_delay)) {
+        Flush();
+      }
+    }
+
+    // Merges values added so far into the total. A thread that stops adding values for
+    // a while should call this to keep the total fresh.
+    void Flush() {
+      if (!pending_) return;
+      pending_ = 0;
+      last_flush_ = CoarseNow();
+      acc_->chain_.Run(&mem_, [acc = acc_, x = std::exchange(value_, T())] {
+        acc->total_ = acc->merge_(acc->total_, x);
+      });
+    }
+
+   private:
+    ThreadLocalAccumulator* const acc_;
+    T value_ = T();
+    std::uint64_t pending_ = 0;
+    std::chrono::steady_clock::time_point last_flush_;
+    ActionChain::Mem mem_;
+  };
+
+  static constexpr std::uint64_t kTimeCheckPeriod = 64;
+
+  ThreadLocalAccumulator() : ThreadLocalAccumulator(Options()) {}
+  explicit ThreadLocalAccumulator(Options opt) : opt_(opt) {}
+  ThreadLocalAccumulator(ThreadLocalAccumulator&&) = delete;
+
+  // Calls `f(const T&)` on the chain with the total of all flushed values. It's stale
+  // by at most Options::flush_every additions per Local, or Options::max_delay for
+  // threads that keep adding values.
+  template <class F>
+  void Read(F&& f) {
+    chain_.Run([this, f = std::forward<F>(f)]() mutable { std::move(f)(std::as_const(total_)); });
+  }
+
+ private:
+  const Options opt_;
+  Merge merge_;
+  // Guarded by chain_.
+  T total_ = T();
+  ActionChain chain_;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_THREAD_LOCAL_ACCUMULATOR_H_
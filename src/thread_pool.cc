@@ -0,0 +1,51 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+namespace romkatv {
+
+ThreadPool::ThreadPool(std::size_t num_threads) {
+  // Without threads nothing would run, and the destructor would wait forever.
+  num_threads = std::max<std::size_t>(num_threads, 1);
+  threads_.reserve(num_threads);
+  for (std::size_t i = 0; i != num_threads; ++i) threads_.emplace_back([this] { Loop(); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread& t : threads_) t.join();
+  assert(tasks_.empty());
+}
+
+void ThreadPool::Schedule(std::function<void()> task) {
+  {
+    std::lock_guard lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+void ThreadPool::Loop() {
+  std::unique_lock lock(mutex_);
+  while (true) {
+    // Running tasks may schedule more, so we can exit only when none are running.
+    cv_.wait(lock, [&] { return !tasks_.empty() || (stop_ && !busy_); });
+    if (tasks_.empty()) break;
+    std::function<void()> task = std::move(tasks_.front());
+    tasks_.pop_front();
+    ++busy_;
+    lock.unlock();
+    task();
+    task = nullptr;
+    lock.lock();
+    if (!--busy_ && stop_ && tasks_.empty()) cv_.notify_all();
+  }
+}
+
+}  // namespace romkatv
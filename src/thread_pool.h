@@ -0,0 +1,43 @@
+#ifndef ROMKATV_ACTION_CHAIN_THREAD_POOL_H_
+#define ROMKATV_ACTION_CHAIN_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace romkatv {
+
+// Fixed number of threads running tasks in FIFO order.
+class ThreadPool {
+ public:
+  // Zero is treated as one.
+  explicit ThreadPool(std::size_t num_threads);
+  ThreadPool(ThreadPool&&) = delete;
+  // Runs all scheduled tasks (including those scheduled by the tasks themselves)
+  // and joins the threads.
+  ~ThreadPool();
+
+  // Thread-safe. Can be called from tasks.
+  void Schedule(std::function<void()> task);
+
+  std::size_t num_threads() const { return threads_.size(); }
+
+ private:
+  void Loop();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  // The number of threads running tasks.
+  std::size_t busy_ = 0;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_THREAD_POOL_H_
@@ -0,0 +1,47 @@
+#include "timer.h"
+
+#include <utility>
+
+namespace romkatv {
+
+Timer::Timer() : thread_([this] { Loop(); }) {}
+
+Timer::~Timer() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void Timer::Schedule(Clock::time_point t, std::function<void()> task) {
+  bool first;
+  {
+    std::lock_guard lock(mutex_);
+    auto it = tasks_.emplace(t, std::move(task));
+    first = it == tasks_.begin();
+  }
+  // The thread sleeps until the first task is due. Wake it up to sleep less.
+  if (first) cv_.notify_one();
+}
+
+void Timer::Loop() {
+  std::unique_lock lock(mutex_);
+  while (!stop_) {
+    if (tasks_.empty()) {
+      cv_.wait(lock);
+    } else if (Clock::now() < tasks_.begin()->first) {
+      cv_.wait_until(lock, tasks_.begin()->first);
+    } else {
+      std::function<void()> task = std::move(tasks_.begin()->second);
+      tasks_.erase(tasks_.begin());
+      lock.unlock();
+      task();
+      task = nullptr;
+      lock.lock();
+    }
+  }
+}
+
+}  // namespace romkatv
@@ -0,0 +1,40 @@
+#ifndef ROMKATV_ACTION_CHAIN_TIMER_H_
+#define ROMKATV_ACTION_CHAIN_TIMER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace romkatv {
+
+// A thread that runs tasks at specified times. Tasks scheduled for the same time run
+// in the order they were scheduled.
+class Timer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  Timer();
+  Timer(Timer&&) = delete;
+  // Waits for the running task, if any, drops the rest and joins the thread.
+  ~Timer();
+
+  // Thread-safe. Can be called from tasks. Tasks due in the past run as soon as
+  // possible.
+  void Schedule(Clock::time_point t, std::function<void()> task);
+
+ private:
+  void Loop();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::multimap<Clock::time_point, std::function<void()>> tasks_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace romkatv
+
+#endif  // ROMKATV_ACTION_CHAIN_TIMER_H_